@@ -25,7 +25,7 @@ namespace Ist
             var target = GetComponent<MPWorld>();
             var ctx = target.GetContext();
             var num = MPAPI.mpGetNumParticles(ctx);
-            var particles = MPAPI.mpGetParticles(ctx);
+            var particles = MPAPI.mpGetParticlesReadOnly(ctx);
 
             var positions = new Vector3[num];
             var t = GetComponent<Transform>().worldToLocalMatrix;
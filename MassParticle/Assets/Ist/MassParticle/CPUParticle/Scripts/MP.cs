@@ -81,6 +81,24 @@ namespace Ist
         public float SPHDensityCoef;
         public float SPHGradPressureCoef;
         public float SPHLapViscosityCoef;
+
+        public int enable_incremental_sort;
+        public int enable_persistent_soa;
+        public int enable_sparse_grid;
+        public int cell_ordering;
+        public int enable_row_spans;
+        public int enable_half_shell;
+        public int enable_neighbor_lists;
+        public float neighbor_list_skin;
+        public int particle_parallel_threshold;
+        public int soa_block_size;
+        public int enable_fused_update;
+        public int enable_task_graph;
+        public int max_threads;
+        public int enable_grain_tuning;
+        public int dense_cell_threshold;
+        public int enable_pipelined_update;
+        public int data_texture_layout;
     };
 
     public enum MPSolverType
@@ -89,10 +107,23 @@ namespace Ist
         SPH = 1,
         SPHEstimate = 2,
     }
+    public enum MPCellOrdering
+    {
+        Linear = 0,
+        Morton = 1,
+    }
+    public enum MPDataTextureLayout
+    {
+        Full = 0,
+        Half = 1,
+        Position = 2,
+        PositionHalf = 3,
+    }
     public enum MPUpdateMode
     {
         Immediate = 0,
         Deferred = 1,
+        Pipelined = 2,
     }
 
     public delegate void MPHitHandler(ref MPParticle particle);
@@ -155,6 +186,26 @@ namespace Ist
         }
     }
 
+    public struct MPPhaseTimings
+    {
+        public float sort;
+        public float cells;
+        public float soa;
+        public float neighbor_lists;
+        public float kernels;
+        public float aos;
+        public float gpu_copy;
+        public float total;
+    };
+
+    public struct MPThreadingParams
+    {
+        public int num_threads;
+        public ulong affinity_mask;
+        public int priority;
+        public int spin_count;
+    };
+
     public unsafe struct MPMeshData
     {
         public int* indices;
@@ -195,6 +246,8 @@ namespace Ist
         public static extern void mpEndUpdate(int context);
         [DllImport("MassParticle")]
         public static extern void mpCallHandlers(int context);
+        [DllImport("MassParticle")]
+        public static extern void mpUpdateAll(int[] contexts, int num_contexts, float dt);
 
         [DllImport("MassParticle")]
         public static extern void mpClearParticles(int context);
@@ -205,6 +258,12 @@ namespace Ist
         public static extern void mpGetKernelParams(int context, ref MPKernelParams p);
         [DllImport("MassParticle")]
         public static extern void mpSetKernelParams(int context, ref MPKernelParams p);
+        [DllImport("MassParticle")]
+        public static extern void mpGetPhaseTimings(int context, ref MPPhaseTimings t);
+        [DllImport("MassParticle")]
+        public static extern void mpGetThreadingParams(ref MPThreadingParams p);
+        [DllImport("MassParticle")]
+        public static extern void mpSetThreadingParams(ref MPThreadingParams p);
 
         [DllImport("MassParticle")]
         public static extern int mpGetNumParticles(int context);
@@ -213,6 +272,8 @@ namespace Ist
         [DllImport("MassParticle")]
         unsafe public static extern MPParticle* mpGetParticles(int context);
         [DllImport("MassParticle")]
+        unsafe public static extern MPParticle* mpGetParticlesReadOnly(int context);
+        [DllImport("MassParticle")]
         public static extern void mpScatterParticlesSphere(int context, ref Vector3 center, float radius, int num, ref MPSpawnParams sp);
         [DllImport("MassParticle")]
         public static extern void mpScatterParticlesBox(int context, ref Vector3 center, ref Vector3 size, int num, ref MPSpawnParams sp);
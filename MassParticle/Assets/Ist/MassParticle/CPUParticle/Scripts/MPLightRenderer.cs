@@ -70,18 +70,9 @@ namespace Ist
 
         public override Material CloneMaterial(Material src, int nth)
         {
-            var instance_texture = m_world.GetInstanceTexture();
-
             Material m = new Material(src);
             m.SetInt("g_batch_begin", nth * m_instances_par_batch);
-            m.SetTexture("g_instance_data", instance_texture);
-
-            Vector4 ts = new Vector4(
-                1.0f / instance_texture.width,
-                1.0f / instance_texture.height,
-                instance_texture.width,
-                instance_texture.height);
-            m.SetVector("g_instance_data_size", ts);
+            m_world.SetInstanceDataParams(m);
 
             if (m_hdr)
             {
@@ -147,6 +138,7 @@ namespace Ist
             {
                 v.SetInt("g_num_max_instances", m_max_instances);
                 v.SetInt("g_num_instances", m_instance_count);
+                if (m_world != null) { m_world.SetInstanceDataParams(v); }
             });
         }
 
@@ -14,6 +14,7 @@ namespace Ist
         public static List<MPWorld> s_instances = new List<MPWorld>();
         public static MPWorld s_current;
         static int s_update_count = 0;
+        static int[] s_contexts = new int[0];
 
         void EachWorld(Action<MPWorld> f)
         {
@@ -34,6 +35,22 @@ namespace Ist
         public bool m_enable_colliders = true;
         public bool m_enable_forces = true;
         public bool m_id_as_float = true;
+        public bool m_incremental_sort = false;
+        public bool m_persistent_soa = false;
+        public bool m_sparse_grid = false;
+        public MPCellOrdering m_cell_ordering = MPCellOrdering.Linear;
+        public bool m_row_spans = false;
+        public bool m_half_shell = false;
+        public bool m_neighbor_lists = false;
+        public float m_neighbor_list_skin = 0.04f;
+        public int m_particle_parallel_threshold = 0;
+        public int m_soa_block_size = 0;
+        public bool m_fused_update = false;
+        public bool m_task_graph = false;
+        public int m_max_threads = 0;
+        public bool m_grain_tuning = false;
+        public int m_dense_cell_threshold = 0;
+        public MPDataTextureLayout m_data_texture_layout = MPDataTextureLayout.Full;
         public float m_particle_mass = 0.1f;
         public float m_timescale = 0.6f;
         public float m_damping = 0.6f;
@@ -53,6 +70,7 @@ namespace Ist
         List<Action> m_actions = new List<Action>();
         List<Action> m_onetime_actions = new List<Action>();
         RenderTexture m_instance_texture;
+        MPDataTextureLayout m_instance_texture_layout;
         bool m_texture_needs_update;
 
 
@@ -68,13 +86,49 @@ namespace Ist
             return m_instance_texture;
         }
 
+        // texture and how to read it. renderers call this every frame as texture is recreated when layout changes.
+        public void SetInstanceDataParams(Material m)
+        {
+            var instance_texture = GetInstanceTexture();
+            m.SetTexture("g_instance_data", instance_texture);
+            Vector4 ts = new Vector4(
+                1.0f / instance_texture.width,
+                1.0f / instance_texture.height,
+                instance_texture.width,
+                instance_texture.height);
+            m.SetVector("g_instance_data_size", ts);
+            m.SetInt("g_instance_data_layout", (int)m_instance_texture_layout);
+            m.SetVector("g_instance_origin", transform.position);
+        }
+
+        public static int GetTexelsEachParticle(MPDataTextureLayout layout)
+        {
+            switch (layout)
+            {
+                case MPDataTextureLayout.Full: return 3;
+                case MPDataTextureLayout.Half: return 2;
+                default: return 1;
+            }
+        }
+
         public void UpdateInstanceTexture()
         {
+            if (m_instance_texture != null && m_instance_texture_layout != m_data_texture_layout)
+            {
+                m_instance_texture.Release();
+                m_instance_texture = null;
+            }
             if (m_instance_texture == null)
             {
-                m_instance_texture = new RenderTexture(MPWorld.DataTextureWidth, MPWorld.DataTextureHeight, 0, RenderTextureFormat.ARGBFloat, RenderTextureReadWrite.Default);
+                // rows enough for as many particles as full layout holds
+                var layout = m_data_texture_layout;
+                bool half = layout == MPDataTextureLayout.Half || layout == MPDataTextureLayout.PositionHalf;
+                int height = (DataTextureWidth * DataTextureHeight / 3 * GetTexelsEachParticle(layout) + DataTextureWidth - 1) / DataTextureWidth;
+                m_instance_texture = new RenderTexture(MPWorld.DataTextureWidth, height, 0,
+                    half ? RenderTextureFormat.ARGBHalf : RenderTextureFormat.ARGBFloat, RenderTextureReadWrite.Default);
                 m_instance_texture.filterMode = FilterMode.Point;
                 m_instance_texture.Create();
+                m_instance_texture_layout = layout;
             }
             if (m_texture_needs_update)
             {
@@ -141,6 +195,10 @@ namespace Ist
             {
                 DeferredUpdate();
             }
+            else if (s_instances[0].m_update_mode == MPUpdateMode.Pipelined)
+            {
+                PipelinedUpdate();
+            }
         }
 
         static void ImmediateUpdate()
@@ -150,9 +208,17 @@ namespace Ist
                 w.UpdateKernelParams();
             }
             UpdateMPObjects();
+            if (s_contexts.Length != s_instances.Count)
+            {
+                s_contexts = new int[s_instances.Count];
+            }
+            for (int i = 0; i < s_contexts.Length; ++i)
+            {
+                s_contexts[i] = s_instances[i].GetContext();
+            }
+            MPAPI.mpUpdateAll(s_contexts, s_contexts.Length, Time.deltaTime);
             foreach (MPWorld w in s_instances)
             {
-                MPAPI.mpUpdate(w.GetContext(), Time.deltaTime);
                 s_current = w;
                 MPAPI.mpCallHandlers(w.GetContext());
                 MPAPI.mpClearCollidersAndForces(w.GetContext());
@@ -183,6 +249,30 @@ namespace Ist
             }
         }
 
+        // next frame is simulated while handlers and update routines run on the last finished frame.
+        // their changes to the worlds are applied at next mpEndUpdate().
+        static void PipelinedUpdate()
+        {
+            foreach (MPWorld w in s_instances)
+            {
+                MPAPI.mpEndUpdate(w.GetContext());
+                w.UpdateKernelParams();
+            }
+            foreach (MPWorld w in s_instances)
+            {
+                MPAPI.mpBeginUpdate(w.GetContext(), Time.deltaTime);
+            }
+            foreach (MPWorld w in s_instances)
+            {
+                s_current = w;
+                MPAPI.mpCallHandlers(w.GetContext());
+                MPAPI.mpClearCollidersAndForces(w.GetContext());
+                w.CallUpdateRoutines();
+                s_current = null;
+            }
+            UpdateMPObjects();
+        }
+
         void CallUpdateRoutines()
         {
             m_actions.ForEach((a) => { a.Invoke(); });
@@ -220,6 +310,23 @@ namespace Ist
             p.enable_colliders = m_enable_colliders ? 1 : 0;
             p.enable_forces = m_enable_forces ? 1 : 0;
             p.id_as_float = m_id_as_float ? 1 : 0;
+            p.enable_incremental_sort = m_incremental_sort ? 1 : 0;
+            p.enable_persistent_soa = m_persistent_soa ? 1 : 0;
+            p.enable_sparse_grid = m_sparse_grid ? 1 : 0;
+            p.cell_ordering = (int)m_cell_ordering;
+            p.enable_row_spans = m_row_spans ? 1 : 0;
+            p.enable_half_shell = m_half_shell ? 1 : 0;
+            p.enable_neighbor_lists = m_neighbor_lists ? 1 : 0;
+            p.neighbor_list_skin = m_neighbor_list_skin;
+            p.particle_parallel_threshold = m_particle_parallel_threshold;
+            p.soa_block_size = m_soa_block_size;
+            p.enable_fused_update = m_fused_update ? 1 : 0;
+            p.enable_task_graph = m_task_graph ? 1 : 0;
+            p.max_threads = m_max_threads;
+            p.enable_grain_tuning = m_grain_tuning ? 1 : 0;
+            p.dense_cell_threshold = m_dense_cell_threshold;
+            p.enable_pipelined_update = m_update_mode == MPUpdateMode.Pipelined ? 1 : 0;
+            p.data_texture_layout = (int)m_data_texture_layout;
             p.timestep = Time.deltaTime * m_timescale;
             p.damping = m_damping;
             p.advection = m_advection;
@@ -63,6 +63,9 @@ GraphicsInterface* CreateGraphicsInterface(DeviceType type, void *device_ptr)
         g_gfx_device = CreateGraphicsInterfaceVulkan(device_ptr);
         break;
 #endif
+    case DeviceType::Null:
+        g_gfx_device = CreateGraphicsInterfaceNull(device_ptr);
+        break;
     }
     return g_gfx_device;
 }
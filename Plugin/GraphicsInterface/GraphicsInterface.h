@@ -11,6 +11,7 @@ enum class DeviceType
     OpenGL,
     Vulkan,
     PS4,
+    Null,   // no GPU. resources live in host memory. for tests and benchmarks.
 };
 
 enum class Result
@@ -80,6 +81,9 @@ public:
     virtual void    releaseTexture2D(void *tex) = 0;
     virtual Result  readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) = 0;
     virtual Result  writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) = 0;
+    // write rows [row_begin, row_begin + num_rows) of dst_tex. other rows are left as they are.
+    // src is num_rows rows of width texels without padding, starting at row_begin.
+    virtual Result  writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src) = 0;
 
     virtual Result  createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags = ResourceFlags::None) = 0;
     virtual void    releaseBuffer(void *buf) = 0;
@@ -101,6 +105,7 @@ public:
 //    e.g:
 //      void *devices[] = {physical_device, device};
 //      CreateGraphicsInterface(DeviceType::Vulkan, devices);
+//  NullDeviceConfig* or nullptr on Null
 GraphicsInterface* CreateGraphicsInterface(DeviceType type, void *device_ptr);
 
 // return instance created by CreateGraphicsInterface()
@@ -109,4 +114,32 @@ GraphicsInterface* GetGraphicsInterface();
 // release existing instance
 void ReleaseGraphicsInterface();
 
+
+struct NullDeviceStats
+{
+    int     num_texture_writes;     // writeTexture2D() and writeTexture2DRows()
+    int     num_texture_reads;
+    int     num_buffer_writes;
+    int     num_buffer_reads;
+    int     num_syncs;
+    size_t  bytes_written;          // bytes that reached resources
+    size_t  bytes_read;
+    size_t  bytes_staged;           // bytes of staging memory writes touched, including row padding
+    double  write_time;             // milliseconds spent in writes, including waits for bandwidth and latency
+    double  max_write_time;         // longest write
+};
+
+// null device: resources live in host memory. writes go through staging memory and then to the resource, as uploads
+// on D3D11/12 and Vulkan do. transfers can be slowed down to simulate a bus.
+// texture handles it didn't create (e.g. native pointers of Unity) get host memory on first write.
+struct NullDeviceConfig
+{
+    double  bandwidth;              // bytes per second of transfers. 0: no wait.
+    double  latency;                // milliseconds each transfer waits in addition to bandwidth
+    int     row_pitch_alignment;    // row pitch of staging memory of textures. 0: rows are packed.
+    NullDeviceStats *stats;         // if not null, calls are counted here. read it while no calls are running.
+
+    NullDeviceConfig() : bandwidth(0.0), latency(0.0), row_pitch_alignment(256), stats(nullptr) {}
+};
+
 } // namespace gi
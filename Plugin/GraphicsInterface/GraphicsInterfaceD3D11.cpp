@@ -23,6 +23,7 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
@@ -238,6 +239,31 @@ Result GraphicsInterfaceD3D11::writeTexture2D(void *dst_tex_, int width, int hei
     return TranslateReturnCode(hr);
 }
 
+Result GraphicsInterfaceD3D11::writeTexture2DRows(void *dst_tex_, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src)
+{
+    if (num_rows <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src || row_begin < 0 || row_begin + num_rows > height) { return Result::InvalidParameter; }
+
+    auto *dst_tex = (ID3D11Texture2D*)dst_tex_;
+    int src_pitch = width * GetTexelSize(format);
+
+    // try direct access
+    D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+    auto hr = m_context->Map(dst_tex, 0, D3D11_MAP_WRITE, 0, &mapped);
+    if (SUCCEEDED(hr)) {
+        auto *dst_pixels = (char*)mapped.pData + (size_t)mapped.RowPitch * row_begin;
+        CopyRegion(dst_pixels, mapped.RowPitch, src, src_pitch, num_rows);
+        m_context->Unmap(dst_tex, 0);
+        return Result::OK;
+    }
+
+
+    // not mappable. the driver copies just the box. (staging + CopyResource() would overwrite other rows)
+    D3D11_BOX box = { 0, (UINT)row_begin, 0, (UINT)width, (UINT)(row_begin + num_rows), 1 };
+    m_context->UpdateSubresource(dst_tex, 0, &box, src, src_pitch, 0);
+    return Result::OK;
+}
+
 
 
 Result GraphicsInterfaceD3D11::createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags)
@@ -24,6 +24,7 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *o_buf, size_t bufsize, void *tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *o_tex, int width, int height, TextureFormat format, const void *buf, size_t bufsize) override;
+    Result writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
@@ -325,6 +326,61 @@ Result GraphicsInterfaceD3D12::writeTexture2D(void *dst_tex_, int width, int hei
     return Result::OK;
 }
 
+Result GraphicsInterfaceD3D12::writeTexture2DRows(void *dst_tex_, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src)
+{
+    if (num_rows <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src || row_begin < 0 || row_begin + num_rows > height) { return Result::InvalidParameter; }
+
+    auto *dst_tex = (ID3D12Resource*)dst_tex_;
+
+    D3D12_RESOURCE_DESC dst_desc = dst_tex->GetDesc();
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT dst_layout;
+    UINT dst_num_rows;
+    UINT64 dst_row_size;
+    UINT64 dst_required_size;
+    m_device->GetCopyableFootprints(&dst_desc, 0, 1, 0, &dst_layout, &dst_num_rows, &dst_row_size, &dst_required_size);
+    if (row_begin + num_rows > (int)dst_layout.Footprint.Height) { return Result::InvalidParameter; }
+
+    // rows are placed where they are in the texture layout, so staging buffer can be copied with the same footprint
+    auto write_proc = [&](ID3D12Resource *dst) {
+        void *mapped_data = nullptr;
+        auto hr = dst->Map(0, nullptr, &mapped_data);
+        if (FAILED(hr)) { return hr; }
+
+        int dst_pitch = dst_layout.Footprint.RowPitch;
+        int src_pitch = width * GetTexelSize(format);
+        CopyRegion((char*)mapped_data + (size_t)dst_pitch * row_begin, dst_pitch, src, src_pitch, num_rows);
+        dst->Unmap(0, nullptr);
+        return S_OK;
+    };
+
+
+    // try direct access
+    auto hr = write_proc(dst_tex);
+    if (SUCCEEDED(hr)) { return Result::OK; }
+
+
+    // try copy-via-staging. only the rows are copied.
+    auto staging = createStagingBuffer(dst_required_size, StagingFlag::Upload);
+    if (!staging) { return Result::OutOfMemory; }
+
+    hr = write_proc(staging.Get());
+    if (FAILED(hr)) { return TranslateReturnCode(hr); }
+
+    hr = executeCommands([&](ID3D12GraphicsCommandList *clist) {
+        CD3DX12_TEXTURE_COPY_LOCATION dst_region(dst_tex, 0);
+        CD3DX12_TEXTURE_COPY_LOCATION src_region(staging.Get(), dst_layout);
+        D3D12_BOX box = { 0, (UINT)row_begin, 0, (UINT)width, (UINT)(row_begin + num_rows), 1 };
+
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(dst_tex, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+        clist->CopyTextureRegion(&dst_region, 0, row_begin, 0, &src_region, &box);
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(dst_tex, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+    });
+    if (FAILED(hr)) { return TranslateReturnCode(hr); }
+
+    return Result::OK;
+}
+
 
 
 Result GraphicsInterfaceD3D12::createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags)
@@ -23,6 +23,7 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
@@ -224,10 +225,12 @@ Result GraphicsInterfaceD3D9::readTexture2D(void *dst, size_t read_size, void *s
     return TranslateReturnCode(hr);
 }
 
-static HRESULT LockSurfaceAndWrite(IDirect3DSurface9 *surf, int width, int height, TextureFormat format, const void *src, size_t write_size)
+// rect: region to write. nullptr: whole surface, and old contents are discarded.
+static HRESULT LockSurfaceAndWrite(IDirect3DSurface9 *surf, int width, int height, TextureFormat format, const void *src, size_t write_size, const RECT *rect = nullptr)
 {
     D3DLOCKED_RECT locked;
-    auto hr = surf->LockRect(&locked, nullptr, D3DLOCK_DISCARD);
+    auto hr = surf->LockRect(&locked, rect, rect ? 0 : D3DLOCK_DISCARD);
+    if (rect) { height = rect->bottom - rect->top; }
     if (SUCCEEDED(hr))
     {
         auto *dst_pixels = (char*)locked.pBits;
@@ -278,6 +281,40 @@ Result GraphicsInterfaceD3D9::writeTexture2D(void *dst_tex, int width, int heigh
     return TranslateReturnCode(hr);
 }
 
+Result GraphicsInterfaceD3D9::writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src)
+{
+    if (num_rows <= 0) { return Result::OK; }
+    if (!dst_tex || !src || row_begin < 0 || row_begin + num_rows > height) { return Result::InvalidParameter; }
+
+    IDirect3DTexture9 *tex = (IDirect3DTexture9*)dst_tex;
+
+    ComPtr<IDirect3DSurface9> surf_dst;
+    auto hr = tex->GetSurfaceLevel(0, &surf_dst);
+    if (FAILED(hr)) { return TranslateReturnCode(hr); }
+
+    RECT rect = { 0, row_begin, width, row_begin + num_rows };
+    size_t write_size = (size_t)GetTexelSize(format) * width * num_rows;
+
+    // try direct access
+    hr = LockSurfaceAndWrite(surf_dst.Get(), width, height, format, src, write_size, &rect);
+    if (SUCCEEDED(hr)) { return Result::OK; }
+
+
+    // try copy-via-staging. only the rect is copied.
+    auto staging = createStagingSurface(width, height, format);
+    if (staging == nullptr) { return Result::Unknown; }
+
+    hr = LockSurfaceAndWrite(staging.Get(), width, height, format, src, write_size, &rect);
+    if (SUCCEEDED(hr))
+    {
+        POINT dst_point = { 0, row_begin };
+        hr = m_device->UpdateSurface(staging.Get(), &rect, surf_dst.Get(), &dst_point);
+        if (SUCCEEDED(hr)) { return Result::OK; }
+    }
+
+    return TranslateReturnCode(hr);
+}
+
 
 enum class MapMode {
     Read,
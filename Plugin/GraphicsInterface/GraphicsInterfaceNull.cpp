@@ -0,0 +1,302 @@
+#include "pch.h"
+#include "giInternal.h"
+#include <cstring>
+#include <chrono>
+#include <memory>
+
+namespace gi {
+
+class GraphicsInterfaceNull : public GraphicsInterface
+{
+public:
+    GraphicsInterfaceNull(void *device);
+    ~GraphicsInterfaceNull() override;
+    void release() override;
+
+    void* getDevicePtr() override;
+    DeviceType getDeviceType() override;
+    void sync() override;
+
+    Result createTexture2D(void **dst_tex, int width, int height, TextureFormat format, const void *data, ResourceFlags flags) override;
+    void   releaseTexture2D(void *tex) override;
+    Result readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) override;
+    Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src) override;
+
+    Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
+    void   releaseBuffer(void *buf) override;
+    Result readBuffer(void *dst, void *src_buf, size_t read_size, BufferType type) override;
+    Result writeBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type) override;
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Texture
+    {
+        int width, height;
+        TextureFormat format;
+        std::vector<char> data;
+    };
+    struct Buffer
+    {
+        BufferType type;
+        std::vector<char> data;
+    };
+
+    Texture* findTexture(void *tex, int width, int height, TextureFormat format);
+    // texture handles of other devices get host memory here. contents are unknown (zero) when size or format changes.
+    Texture* findOrCreateTexture(void *tex, int width, int height, TextureFormat format);
+    Buffer* findBuffer(void *buf, BufferType type);
+    // src -> staging -> tex, from row_begin. last row can be partial.
+    void uploadRows(Texture &tex, int row_begin, const void *src, size_t size);
+    // wait as long as transferring size bytes takes
+    void waitTransfer(size_t size);
+    void endWrite(Clock::time_point begin);
+
+private:
+    NullDeviceConfig m_config;
+    NullDeviceStats m_local_stats;
+    NullDeviceStats &m_stats;       // m_config.stats or m_local_stats
+    std::vector<char> m_staging;
+    std::map<void*, std::unique_ptr<Texture>> m_textures;
+    std::map<void*, std::unique_ptr<Buffer>> m_buffers;
+    std::mutex m_mutex;
+};
+
+
+GraphicsInterface* CreateGraphicsInterfaceNull(void *device)
+{
+    return new GraphicsInterfaceNull(device);
+}
+
+GraphicsInterfaceNull::GraphicsInterfaceNull(void *device)
+    : m_config(device ? *(const NullDeviceConfig*)device : NullDeviceConfig())
+    , m_local_stats()
+    , m_stats(m_config.stats ? *m_config.stats : m_local_stats)
+{
+}
+
+GraphicsInterfaceNull::~GraphicsInterfaceNull()
+{
+}
+
+void GraphicsInterfaceNull::release()
+{
+    delete this;
+}
+
+void* GraphicsInterfaceNull::getDevicePtr() { return nullptr; }
+DeviceType GraphicsInterfaceNull::getDeviceType() { return DeviceType::Null; }
+
+void GraphicsInterfaceNull::sync()
+{
+    // transfers are done when calls return
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++m_stats.num_syncs;
+}
+
+GraphicsInterfaceNull::Texture* GraphicsInterfaceNull::findTexture(void *tex, int width, int height, TextureFormat format)
+{
+    auto it = m_textures.find(tex);
+    if (it == m_textures.end()) { return nullptr; }
+    auto *t = it->second.get();
+    if (t->width != width || t->height != height || t->format != format) { return nullptr; }
+    return t;
+}
+
+GraphicsInterfaceNull::Texture* GraphicsInterfaceNull::findOrCreateTexture(void *tex, int width, int height, TextureFormat format)
+{
+    if (width <= 0 || height <= 0 || GetTexelSize(format) == 0) { return nullptr; }
+
+    auto &t = m_textures[tex];
+    if (!t) { t.reset(new Texture()); }
+    if (t->width != width || t->height != height || t->format != format) {
+        t->width = width;
+        t->height = height;
+        t->format = format;
+        t->data.assign(size_t(width) * height * GetTexelSize(format), 0);
+    }
+    return t.get();
+}
+
+GraphicsInterfaceNull::Buffer* GraphicsInterfaceNull::findBuffer(void *buf, BufferType type)
+{
+    auto it = m_buffers.find(buf);
+    if (it == m_buffers.end() || it->second->type != type) { return nullptr; }
+    return it->second.get();
+}
+
+void GraphicsInterfaceNull::waitTransfer(size_t size)
+{
+    double ms = m_config.latency;
+    if (m_config.bandwidth > 0.0) { ms += double(size) / m_config.bandwidth * 1000.0; }
+    if (ms <= 0.0) { return; }
+
+    // spin. sleep is too coarse for transfers of a few hundred microseconds.
+    auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+    while (Clock::now() < end) {}
+}
+
+void GraphicsInterfaceNull::endWrite(Clock::time_point begin)
+{
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    m_stats.write_time += ms;
+    m_stats.max_write_time = std::max<double>(m_stats.max_write_time, ms);
+}
+
+void GraphicsInterfaceNull::uploadRows(Texture &tex, int row_begin, const void *src, size_t size)
+{
+    size_t pitch = size_t(tex.width) * GetTexelSize(tex.format);
+    size_t staging_pitch = pitch;
+    if (m_config.row_pitch_alignment > 0) {
+        staging_pitch = ceildiv<size_t>(pitch, m_config.row_pitch_alignment) * m_config.row_pitch_alignment;
+    }
+    int num_rows = (int)ceildiv<size_t>(size, pitch);
+    size_t staging_size = staging_pitch * num_rows;
+    if (m_staging.size() < staging_size) { m_staging.resize(staging_size); }
+
+    // CPU writes staging memory, then copy engine moves it to the texture
+    for (int ri = 0; ri < num_rows; ++ri) {
+        memcpy(&m_staging[staging_pitch * ri], (const char*)src + pitch * ri, std::min<size_t>(pitch, size - pitch * ri));
+    }
+    waitTransfer(staging_size);
+    for (int ri = 0; ri < num_rows; ++ri) {
+        memcpy(&tex.data[pitch * (row_begin + ri)], &m_staging[staging_pitch * ri], std::min<size_t>(pitch, size - pitch * ri));
+    }
+
+    m_stats.bytes_staged += staging_size;
+    m_stats.bytes_written += size;
+}
+
+Result GraphicsInterfaceNull::createTexture2D(void **dst_tex, int width, int height, TextureFormat format, const void *data, ResourceFlags /*flags*/)
+{
+    if (!dst_tex || width <= 0 || height <= 0 || GetTexelSize(format) == 0) { return Result::InvalidParameter; }
+
+    auto *t = new Texture();
+    t->width = width;
+    t->height = height;
+    t->format = format;
+    t->data.resize(size_t(width) * height * GetTexelSize(format));
+    if (data) { memcpy(t->data.data(), data, t->data.size()); }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_textures[t].reset(t);
+    *dst_tex = t;
+    return Result::OK;
+}
+
+void GraphicsInterfaceNull::releaseTexture2D(void *tex)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_textures.erase(tex);
+}
+
+Result GraphicsInterfaceNull::readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format)
+{
+    if (read_size == 0) { return Result::OK; }
+    if (!dst || !src_tex) { return Result::InvalidParameter; }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto *t = findTexture(src_tex, width, height, format);
+    if (!t) { return Result::InvalidParameter; }
+
+    read_size = std::min<size_t>(read_size, t->data.size());
+    waitTransfer(read_size);
+    memcpy(dst, t->data.data(), read_size);
+    ++m_stats.num_texture_reads;
+    m_stats.bytes_read += read_size;
+    return Result::OK;
+}
+
+Result GraphicsInterfaceNull::writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size)
+{
+    if (write_size == 0) { return Result::OK; }
+    if (!dst_tex || !src) { return Result::InvalidParameter; }
+
+    auto begin = Clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto *t = findOrCreateTexture(dst_tex, width, height, format);
+    if (!t) { return Result::InvalidParameter; }
+
+    uploadRows(*t, 0, src, std::min<size_t>(write_size, t->data.size()));
+    ++m_stats.num_texture_writes;
+    endWrite(begin);
+    return Result::OK;
+}
+
+Result GraphicsInterfaceNull::writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src)
+{
+    if (num_rows <= 0) { return Result::OK; }
+    if (!dst_tex || !src || row_begin < 0 || row_begin + num_rows > height) { return Result::InvalidParameter; }
+
+    auto begin = Clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto *t = findOrCreateTexture(dst_tex, width, height, format);
+    if (!t) { return Result::InvalidParameter; }
+
+    uploadRows(*t, row_begin, src, size_t(width) * GetTexelSize(format) * num_rows);
+    ++m_stats.num_texture_writes;
+    endWrite(begin);
+    return Result::OK;
+}
+
+Result GraphicsInterfaceNull::createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags /*flags*/)
+{
+    if (!dst_buf) { return Result::InvalidParameter; }
+
+    auto *b = new Buffer();
+    b->type = type;
+    b->data.resize(size);
+    if (data) { memcpy(b->data.data(), data, size); }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_buffers[b].reset(b);
+    *dst_buf = b;
+    return Result::OK;
+}
+
+void GraphicsInterfaceNull::releaseBuffer(void *buf)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_buffers.erase(buf);
+}
+
+Result GraphicsInterfaceNull::readBuffer(void *dst, void *src_buf, size_t read_size, BufferType type)
+{
+    if (read_size == 0) { return Result::OK; }
+    if (!dst || !src_buf) { return Result::InvalidParameter; }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto *b = findBuffer(src_buf, type);
+    if (!b || read_size > b->data.size()) { return Result::InvalidParameter; }
+
+    waitTransfer(read_size);
+    memcpy(dst, b->data.data(), read_size);
+    ++m_stats.num_buffer_reads;
+    m_stats.bytes_read += read_size;
+    return Result::OK;
+}
+
+Result GraphicsInterfaceNull::writeBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type)
+{
+    if (write_size == 0) { return Result::OK; }
+    if (!dst_buf || !src) { return Result::InvalidParameter; }
+
+    auto begin = Clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto *b = findBuffer(dst_buf, type);
+    if (!b || write_size > b->data.size()) { return Result::InvalidParameter; }
+
+    if (m_staging.size() < write_size) { m_staging.resize(write_size); }
+    memcpy(m_staging.data(), src, write_size);
+    waitTransfer(write_size);
+    memcpy(b->data.data(), m_staging.data(), write_size);
+
+    ++m_stats.num_buffer_writes;
+    m_stats.bytes_staged += write_size;
+    m_stats.bytes_written += write_size;
+    endWrite(begin);
+    return Result::OK;
+}
+
+} // namespace gi
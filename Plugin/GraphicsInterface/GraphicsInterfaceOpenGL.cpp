@@ -55,6 +55,7 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
@@ -196,6 +197,24 @@ Result GraphicsInterfaceOpenGL::writeTexture2D(void *dst_tex, int width, int hei
     return ret;
 }
 
+Result GraphicsInterfaceOpenGL::writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src)
+{
+    if (num_rows <= 0) { return Result::OK; }
+    if (!dst_tex || !src || row_begin < 0 || row_begin + num_rows > height) { return Result::InvalidParameter; }
+
+    GLenum gl_format = 0;
+    GLenum gl_type = 0;
+    GLenum gl_iformat = 0;
+    GetGLTextureType(format, gl_format, gl_type, gl_iformat);
+
+    auto ret = Result::OK;
+    glBindTexture(GL_TEXTURE_2D, (GLuint)(size_t)dst_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row_begin, width, num_rows, gl_format, gl_type, src);
+    ret = GetGLError();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return ret;
+}
+
 
 static GLenum GetGLBufferType(BufferType type)
 {
@@ -69,6 +69,7 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *buf, size_t bufsize) override;
+    Result writeTexture2DRows(void *dst_tex, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
@@ -441,6 +442,41 @@ Result GraphicsInterfaceVulkan::writeTexture2D(void *dst_tex_, int width, int he
     return Result::OK;
 }
 
+Result GraphicsInterfaceVulkan::writeTexture2DRows(void *dst_tex_, int width, int height, TextureFormat format, int row_begin, int num_rows, const void *src)
+{
+    if (num_rows <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src || row_begin < 0 || row_begin + num_rows > height) { return Result::InvalidParameter; }
+
+    auto dst_tex = (VkImage)dst_tex_;
+    size_t pitch = (size_t)width * GetTexelSize(format);
+
+    auto staging_buffer = unique_handle<VkBuffer>(m_device);
+    auto staging_memory = unique_handle<VkDeviceMemory>(m_device);
+    auto vr = createStagingBuffer(dst_tex, StagingFlag::Upload, staging_buffer.ref(), staging_memory.ref());
+    if (vr != VK_SUCCESS) { return TranslateReturnCode(vr); }
+
+    vr = map(staging_memory.get(), [&](void *mapped_memory) {
+        memcpy(mapped_memory, src, pitch * num_rows);
+    });
+    if (vr != VK_SUCCESS) { return TranslateReturnCode(vr); }
+
+    vr = executeCommands([&](VkCommandBuffer clist) {
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset.y = row_begin;
+        region.imageExtent.width = width;
+        region.imageExtent.height = num_rows;
+        region.imageExtent.depth = 1;
+        vkCmdCopyBufferToImage(clist, staging_buffer.get(), dst_tex, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    });
+    if (vr != VK_SUCCESS) { return TranslateReturnCode(vr); }
+
+    return Result::OK;
+}
+
 
 Result GraphicsInterfaceVulkan::createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags)
 {
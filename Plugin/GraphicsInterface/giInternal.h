@@ -11,7 +11,7 @@
     #define giSupportD3D12
     #define giSupportOpenGL
     #define giSupportVulkan
-#else
+#elif !defined(giWithoutOpenGL)
     #define giSupportOpenGL
 #endif
 
@@ -25,6 +25,7 @@ GraphicsInterface* CreateGraphicsInterfaceD3D11(void *device);
 GraphicsInterface* CreateGraphicsInterfaceD3D12(void *device);
 GraphicsInterface* CreateGraphicsInterfaceOpenGL(void *device);
 GraphicsInterface* CreateGraphicsInterfaceVulkan(void *device);
+GraphicsInterface* CreateGraphicsInterfaceNull(void *device);
 
 
 // i.e:
@@ -1,6 +1,7 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <array>
 #include <vector>
 #include <map>
@@ -6,6 +6,7 @@
 
 namespace {
     std::vector<mpWorld*> g_worlds;
+    mpThreadingParams g_threading_params;
 }
 
 extern "C" {
@@ -64,6 +65,16 @@ mpAPI void mpEndUpdate(int context)
     g_worlds[context]->endUpdate();
 }
 
+mpAPI void mpUpdateAll(const int *contexts, int num_contexts, float dt)
+{
+    mpTraceFunc();
+    std::vector<mpWorld*> worlds(num_contexts);
+    for (int i = 0; i < num_contexts; ++i) {
+        worlds[i] = g_worlds[contexts[i]];
+    }
+    mpWorld::updateAll(worlds.data(), num_contexts, dt);
+}
+
 mpAPI void mpCallHandlers(int context)
 {
     mpTraceFunc();
@@ -95,6 +106,31 @@ mpAPI void mpSetKernelParams(int context, const mpKernelParams *params)
     g_worlds[context]->setKernelParams(*params);
 }
 
+mpAPI void mpGetPhaseTimings(int context, mpPhaseTimings *timings)
+{
+    mpTraceFunc();
+    *timings = g_worlds[context]->getPhaseTimings();
+}
+
+mpAPI void mpGetThreadingParams(mpThreadingParams *params)
+{
+    mpTraceFunc();
+    *params = g_threading_params;
+}
+
+mpAPI void mpSetThreadingParams(const mpThreadingParams *params)
+{
+    mpTraceFunc();
+    g_threading_params = *params;
+
+    ist::threading_params tp;
+    tp.num_threads = params->num_threads;
+    tp.affinity_mask = params->affinity_mask;
+    tp.priority = params->priority;
+    tp.spin_count = params->spin_count;
+    ist::set_threading_params(tp);
+}
+
 
 mpAPI int mpGetNumParticles(int context)
 {
@@ -122,6 +158,12 @@ mpAPI mpParticle* mpGetParticles(int context)
     return g_worlds[context]->getParticles();
 }
 
+mpAPI const mpParticle* mpGetParticlesReadOnly(int context)
+{
+    mpTraceFunc();
+    return g_worlds[context]->getParticlesReadOnly();
+}
+
 
 inline void mpApplySpawnParams(mpParticleCont &particles, const mpSpawnParams *params)
 {
@@ -429,7 +471,7 @@ mpAPI void mpMoveAll(int context, vec3 *move_amount)
 
 } // extern "C"
 
-void mpSetGraphicsInterface(mpGraphicsInterfaceType device_type, void* device_ptr)
+mpAPI void mpSetGraphicsInterface(mpGraphicsInterfaceType device_type, void* device_ptr)
 {
     mpTraceFunc();
     gi::CreateGraphicsInterface((gi::DeviceType)device_type, device_ptr);
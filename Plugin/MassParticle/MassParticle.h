@@ -24,6 +24,21 @@ enum class mpSolverType
     SPHEst,
 };
 
+enum class mpCellOrdering
+{
+    Linear, // x | z<<bx | y<<(bx+bz)
+    Morton, // bits of x, z, y interleaved. neighbor cells are closer in memory.
+};
+
+// what data texture holds for each particle
+enum class mpDataTextureLayout
+{
+    Full,           // 3 RGBAf32 texels: whole mpParticle
+    Half,           // 2 RGBAf16 texels: (position - world_center, id & 2047), (velocity, lifetime)
+    Position,       // 1 RGBAf32 texel: (position, lifetime)
+    PositionHalf,   // 1 RGBAf16 texel: (position - world_center, lifetime)
+};
+
 enum class mpForceShape
 {
     AffectAll,
@@ -82,6 +97,23 @@ enum class mpForceType
         float SPHParticleMass;
         float SPHViscosity;
         float reserved[4];
+        int32_t enable_incremental_sort; // re-sort only particles that changed cell since last frame
+        int32_t enable_persistent_soa;   // keep particles in SoA form. mpGetParticles() builds AoS view on demand and makes AoS the master data until next update. mpGetParticlesReadOnly() doesn't.
+        int32_t enable_sparse_grid;      // store only occupied cells. cells wrap around world_div instead of clamping to world extent.
+        mpCellOrdering cell_ordering;    // order of cells (and particles) in memory
+        int32_t enable_row_spans;        // pack x-adjacent cells in SoA data so neighbor search visits 9 spans instead of 27 cells. needs Linear cell_ordering.
+        int32_t enable_half_shell;       // evaluate each particle pair once and apply equal and opposite forces. cells run in colored passes.
+        int32_t enable_neighbor_lists;   // cache per-particle neighbor lists across frames. SPH solver, and Impulse solver if advection is 0.
+        float neighbor_list_skin;        // margin added to interaction range of neighbor lists. lists are rebuilt when a particle moves more than half of this.
+        int32_t particle_parallel_threshold; // cells with at least this many particles vectorize interaction across own particles instead of neighbors. 0: half of SIMD width. negative: never.
+        int32_t soa_block_size;          // SoA data of each cell is padded and aligned to this many particles. 8 or 16. 0: SIMD width of the kernels, at least 8.
+        int32_t enable_fused_update;     // Impulse solver: interaction, forces, colliders and integration in one sweep over cells, with double buffered positions and velocities.
+        int32_t enable_task_graph;       // multi-pass solvers: run passes of each tile of cells as soon as neighbor tiles finish previous pass, instead of waiting for all cells. needs Linear cell_ordering.
+        int32_t max_threads;             // at most this many threads work for this context at a time. 0: no limit.
+        int32_t enable_grain_tuning;     // measure update time with some task sizes and use the fastest.
+        int32_t dense_cell_threshold;    // particles of cells with more than this many are sorted along their longest axis, and neighbor search binary searches them. 0: off. impulse solver sorts them only if advection is 0, because advection has no range limit.
+        int32_t enable_pipelined_update; // between mpBeginUpdate() and mpEndUpdate(), reads, scans and handlers use the last finished frame, and changes are deferred to mpEndUpdate().
+        mpDataTextureLayout data_texture_layout; // what mpUpdateDataTexture() writes. texture must be RGBAf16 for half layouts, and hold 3, 2 or 1 texels for each particle.
 
         mpKernelParams()
         {
@@ -89,6 +121,8 @@ enum class mpForceType
             world_extent = mpV3(10.24f, 10.24f, 10.24f);
             world_div    = mpV3i(128, 128, 128);
             coord_scaler = mpV3(1.0f, 1.0f, 1.0f);
+            active_region_center = world_center;
+            active_region_extent = world_extent;
 
             solver_type = mpSolverType::Impulse;
             enable_interaction = 1;
@@ -107,6 +141,24 @@ enum class mpForceType
             SPHRestDensity = 1000.0f;
             SPHParticleMass = 0.002f;
             SPHViscosity = 0.1f;
+
+            enable_incremental_sort = 0;
+            enable_persistent_soa = 0;
+            enable_sparse_grid = 0;
+            cell_ordering = mpCellOrdering::Linear;
+            enable_row_spans = 0;
+            enable_half_shell = 0;
+            enable_neighbor_lists = 0;
+            neighbor_list_skin = 0.04f;
+            particle_parallel_threshold = 0;
+            soa_block_size = 0;
+            enable_fused_update = 0;
+            enable_task_graph = 0;
+            max_threads = 0;
+            enable_grain_tuning = 0;
+            dense_cell_threshold = 0;
+            enable_pipelined_update = 0;
+            data_texture_layout = mpDataTextureLayout::Full;
         }
 
     };
@@ -126,6 +178,28 @@ enum class mpForceType
         int userdata;
     };
 
+    // wall time of each phase of last update in milliseconds
+    struct mpPhaseTimings
+    {
+        float sort;             // hash and sort
+        float cells;            // cell list and SoA layout
+        float soa;              // gather to SoA data
+        float neighbor_lists;
+        float kernels;          // interaction, forces, colliders and integration
+        float aos;              // SoA -> AoS
+        float gpu_copy;
+        float total;
+    };
+
+    // worker threads shared by all contexts
+    struct mpThreadingParams
+    {
+        int32_t num_threads;        // workers + calling thread. 0: number of cores
+        uint64_t affinity_mask;     // bit i: workers can run on core i. 0: any core
+        int32_t priority;           // priority of workers. -2 (lowest) - 2 (highest), 0: normal
+        int32_t spin_count;         // times idle workers and waiting threads look for tasks before they sleep. 0: default, negative: never sleep
+    };
+
     struct mpParticleIM
     {
         mpV3 accel;
@@ -194,17 +268,25 @@ mpAPI void           mpUpdate(int context, float dt);
 mpAPI void           mpBeginUpdate(int context, float dt);   // async version
 mpAPI void           mpEndUpdate(int context);               // 
 mpAPI void           mpCallHandlers(int context);
+mpAPI void           mpUpdateAll(const int *contexts, int num_contexts, float dt); // update contexts at once. threads are shared by particle count.
 
 mpAPI void           mpClearParticles(int context);
 mpAPI void           mpClearCollidersAndForces(int context);
 
 mpAPI void           mpGetKernelParams(int context, mpKernelParams *params);
 mpAPI void           mpSetKernelParams(int context, const mpKernelParams *params);
+mpAPI void           mpGetPhaseTimings(int context, mpPhaseTimings *timings); // timings of last update
+
+// restarts worker threads. call while no context is updating.
+// TBB backend ignores spin_count. PPL backend applies only num_threads and priority, and only before first update.
+mpAPI void           mpGetThreadingParams(mpThreadingParams *params);
+mpAPI void           mpSetThreadingParams(const mpThreadingParams *params);
 
 mpAPI int            mpGetNumParticles(int context);
 mpAPI void           mpForceSetNumParticles(int context, int num);
 mpAPI mpParticleIM*  mpGetIntermediateData(int context, int nth=-1);
 mpAPI mpParticle*    mpGetParticles(int context);
+mpAPI const mpParticle* mpGetParticlesReadOnly(int context); // cheaper than mpGetParticles() on persistent SoA. particles must not be modified.
 mpAPI void           mpAddParticles(int context, mpParticle *particles, int num_particles);
 mpAPI void           mpScatterParticlesSphere(int context, mpV3 *center, float radius, int num, const mpSpawnParams *params);
 mpAPI void           mpScatterParticlesBox(int context, mpV3 *center, mpV3 *size, int num, const mpSpawnParams *params);
@@ -229,6 +311,7 @@ mpAPI void           mpMoveAll(int context, mpV3 *move_amount);
 } // extern "C"
 
 // for static link usage. initialize graphics device manually.
+// Null keeps textures in host memory and needs no GPU. device_ptr is gi::NullDeviceConfig* or nullptr.
 enum class mpGraphicsInterfaceType
 {
     Unknown,
@@ -238,5 +321,6 @@ enum class mpGraphicsInterfaceType
     OpenGL,
     Vulkan,
     PS4,
+    Null,
 };
-void mpSetGraphicsInterface(mpGraphicsInterfaceType device_type, void* device_ptr);
+mpAPI void mpSetGraphicsInterface(mpGraphicsInterfaceType device_type, void* device_ptr);
@@ -2,6 +2,7 @@
 #include <emmintrin.h>
 #include <pmmintrin.h>
 #include <tmmintrin.h>
+#include <immintrin.h>
 
 #define SSE_SHUFFLE(x,y,z,w) _MM_SHUFFLE(w,z,y,x)
 #ifdef _MSC_VER
@@ -10,6 +11,15 @@
 #   define istForceInline inline
 #endif // _MSC_VER
 
+// functions that use AVX instructions. caller must check the cpu supports AVX.
+// msvc can emit them in any function. gcc and clang need target attribute, and caller must have it too to inline them.
+#if defined(_MSC_VER) || defined(__AVX__)
+#   define istAVXTarget
+#else
+#   define istAVXTarget __attribute__((target("avx")))
+#endif
+#define istAVXFunc istForceInline istAVXTarget
+
 //#define __ist_enable_soavec8__
 
 
@@ -18,8 +28,8 @@ namespace ist {
 
 typedef __m128  simdvec4;
 typedef __m128i simdvec4i;
-//typedef __m256  simdvec8;
-//typedef __m256i simdvec8i;
+typedef __m256  simdvec8;
+typedef __m256i simdvec8i;
 
 
 istForceInline simdvec4 add(simdvec4 a, simdvec4 b) { return _mm_add_ps(a, b); }
@@ -445,6 +455,81 @@ inline vec4soa4 soa_transpose44(const simdvec4 &v0, const simdvec4 &v1, const si
 }
 
 
+// 8 wide (AVX)
+// same as soa_transpose*4 for each 128 bit lane: lane 0 has v0-v3, lane 1 has v4-v7.
+
+// in:  {x,y,z,w}[8]
+// out: 
+//      x[0], x[1], ..., x[7]
+//      y[0], y[1], ..., y[7]
+//      z[0], z[1], ..., z[7]
+istAVXFunc void soa_transpose38(
+    const simdvec4 &v0, const simdvec4 &v1, const simdvec4 &v2, const simdvec4 &v3,
+    const simdvec4 &v4, const simdvec4 &v5, const simdvec4 &v6, const simdvec4 &v7,
+    simdvec8 *out)
+{
+    __m256 a = _mm256_insertf128_ps(_mm256_castps128_ps256(v0), v4, 1);
+    __m256 b = _mm256_insertf128_ps(_mm256_castps128_ps256(v1), v5, 1);
+    __m256 c = _mm256_insertf128_ps(_mm256_castps128_ps256(v2), v6, 1);
+    __m256 d = _mm256_insertf128_ps(_mm256_castps128_ps256(v3), v7, 1);
+    __m256 r1 = _mm256_unpacklo_ps(a, b);
+    __m256 r2 = _mm256_unpacklo_ps(c, d);
+    __m256 r3 = _mm256_unpackhi_ps(a, b);
+    __m256 r4 = _mm256_unpackhi_ps(c, d);
+    out[0] = _mm256_shuffle_ps(r1, r2, SSE_SHUFFLE(0,1,0,1));
+    out[1] = _mm256_shuffle_ps(r1, r2, SSE_SHUFFLE(2,3,2,3));
+    out[2] = _mm256_shuffle_ps(r3, r4, SSE_SHUFFLE(0,1,0,1));
+}
+
+// in:  {x,y,z,w}[8]
+// out: 
+//      x[0], x[1], ..., x[7]
+//      y[0], y[1], ..., y[7]
+//      z[0], z[1], ..., z[7]
+//      w[0], w[1], ..., w[7]
+istAVXFunc void soa_transpose48(
+    const simdvec4 &v0, const simdvec4 &v1, const simdvec4 &v2, const simdvec4 &v3,
+    const simdvec4 &v4, const simdvec4 &v5, const simdvec4 &v6, const simdvec4 &v7,
+    simdvec8 *out)
+{
+    __m256 a = _mm256_insertf128_ps(_mm256_castps128_ps256(v0), v4, 1);
+    __m256 b = _mm256_insertf128_ps(_mm256_castps128_ps256(v1), v5, 1);
+    __m256 c = _mm256_insertf128_ps(_mm256_castps128_ps256(v2), v6, 1);
+    __m256 d = _mm256_insertf128_ps(_mm256_castps128_ps256(v3), v7, 1);
+    __m256 r1 = _mm256_unpacklo_ps(a, b);
+    __m256 r2 = _mm256_unpacklo_ps(c, d);
+    __m256 r3 = _mm256_unpackhi_ps(a, b);
+    __m256 r4 = _mm256_unpackhi_ps(c, d);
+    out[0] = _mm256_shuffle_ps(r1, r2, SSE_SHUFFLE(0,1,0,1));
+    out[1] = _mm256_shuffle_ps(r1, r2, SSE_SHUFFLE(2,3,2,3));
+    out[2] = _mm256_shuffle_ps(r3, r4, SSE_SHUFFLE(0,1,0,1));
+    out[3] = _mm256_shuffle_ps(r3, r4, SSE_SHUFFLE(2,3,2,3));
+}
+
+// inverse of soa_transpose48
+// in:  x[8], y[8], z[8], w[8]
+// out: {x,y,z,w}[8]
+istAVXFunc void aos_transpose48(const simdvec8 &x, const simdvec8 &y, const simdvec8 &z, const simdvec8 &w, simdvec4 *out)
+{
+    __m256 r1 = _mm256_unpacklo_ps(x, y);
+    __m256 r2 = _mm256_unpacklo_ps(z, w);
+    __m256 r3 = _mm256_unpackhi_ps(x, y);
+    __m256 r4 = _mm256_unpackhi_ps(z, w);
+    __m256 t0 = _mm256_shuffle_ps(r1, r2, SSE_SHUFFLE(0,1,0,1));
+    __m256 t1 = _mm256_shuffle_ps(r1, r2, SSE_SHUFFLE(2,3,2,3));
+    __m256 t2 = _mm256_shuffle_ps(r3, r4, SSE_SHUFFLE(0,1,0,1));
+    __m256 t3 = _mm256_shuffle_ps(r3, r4, SSE_SHUFFLE(2,3,2,3));
+    out[0] = _mm256_castps256_ps128(t0);
+    out[1] = _mm256_castps256_ps128(t1);
+    out[2] = _mm256_castps256_ps128(t2);
+    out[3] = _mm256_castps256_ps128(t3);
+    out[4] = _mm256_extractf128_ps(t0, 1);
+    out[5] = _mm256_extractf128_ps(t1, 1);
+    out[6] = _mm256_extractf128_ps(t2, 1);
+    out[7] = _mm256_extractf128_ps(t3, 1);
+}
+
+
 
 istForceInline vec4soa2 operator+(const vec4soa2 &a, const vec4soa2 &b)
     { return vec4soa2(add(a[0],b[0]), add(a[1],b[1])); }
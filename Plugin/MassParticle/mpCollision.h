@@ -121,7 +121,7 @@ struct Force
 struct Cell
 {
     int begin, end;
-    int soai;
+    int soai; // index of first particle in SoA data
     float density;
 };
 
@@ -156,4 +156,22 @@ struct KernelParams
     float SPHDensityCoef;
     float SPHGradPressureCoef;
     float SPHLapViscosityCoef;
+
+    int enable_incremental_sort;
+    int enable_persistent_soa;
+    int enable_sparse_grid;
+    int cell_ordering;
+    int enable_row_spans;
+    int enable_half_shell;
+    int enable_neighbor_lists;
+    float neighbor_list_skin;
+    int particle_parallel_threshold;
+    int soa_block_size;
+    int enable_fused_update;
+    int enable_task_graph;
+    int max_threads;
+    int enable_grain_tuning;
+    int dense_cell_threshold;
+    int enable_pipelined_update;
+    int data_texture_layout;
 };
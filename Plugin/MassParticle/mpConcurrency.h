@@ -1,10 +1,24 @@
 #pragma once
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <mutex>
-#ifdef mpWithTBB
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <condition_variable>
+
+// backend of ist:: primitives: mpWithWorkStealing: built-in work stealing scheduler (ist::ws), mpWithTBB: TBB,
+// otherwise PPL on Windows and ist::ws elsewhere. ist::ws is always available, to compare with other backends.
+#if defined(mpWithWorkStealing) || (!defined(mpWithTBB) && !defined(_WIN32))
+    #define istWithWorkStealing
+#elif defined(mpWithTBB)
     #include <tbb/tbb.h>
     #include <tbb/combinable.h>
-#elif _WIN32
+#else
     #include <ppl.h>
 #endif
 #ifdef _WIN32
@@ -12,6 +26,12 @@
 #else
     #include <pthread.h>
 #endif
+#ifdef __linux__
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+#endif
 
 namespace ist {
 
@@ -50,7 +70,7 @@ public:
 
     ~tls()
     {
-        std::unique_lock<std::mutex> lock;
+        std::unique_lock<std::mutex> lock(m_mutex);
         for (auto p : m_locals) { delete p; }
         m_locals.clear();
     }
@@ -64,7 +84,7 @@ public:
             value = v;
 
             {
-                std::unique_lock<std::mutex> lock;
+                std::unique_lock<std::mutex> lock(m_mutex);
                 m_locals.push_back(v);
             }
         }
@@ -83,59 +103,707 @@ protected:
 };
 
 
-#ifdef WithTBB
+#ifdef _MSC_VER
+    #define istThreadLocal __declspec(thread)
+#else
+    #define istThreadLocal __thread
+#endif
+
+
+// worker thread settings. see set_threading_params().
+struct threading_params
+{
+    int num_threads;        // workers + calling thread. 0: number of cores
+    uint64_t affinity_mask; // bit i: worker can run on core i. 0: any core
+    int priority;           // -2 (lowest) - 2 (highest) relative to normal
+    int spin_count;         // times idle worker or waiting thread looks for tasks before it sleeps. 0: default, negative: never sleep
+
+    threading_params() : num_threads(0), affinity_mask(0), priority(0), spin_count(0) {}
+};
+
+// apply to calling thread. these are hints: return false if the platform refuses.
+inline bool set_thread_affinity(uint64_t mask)
+{
+#if defined(_WIN32)
+    return ::SetThreadAffinityMask(::GetCurrentThread(), (DWORD_PTR)mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int i = 0; i < 64 && i < CPU_SETSIZE; ++i) {
+        if (mask & (uint64_t(1) << i)) { CPU_SET(i, &cpus); }
+    }
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    return false;
+#endif
+}
+
+inline bool set_thread_priority(int priority)
+{
+    priority = std::min<int>(std::max<int>(priority, -2), 2);
+#if defined(_WIN32)
+    return ::SetThreadPriority(::GetCurrentThread(), priority) != 0;
+#elif defined(__linux__)
+    // nice value of the thread. raising priority above normal needs privilege and fails without it.
+    return ::setpriority(PRIO_PROCESS, (id_t)::syscall(SYS_gettid), -priority * 5) == 0;
+#else
+    return false;
+#endif
+}
+
+// per-thread cap of the number of tasks parallel loops started from the thread are split into. 0: no cap.
+// loops nested in a capped loop run serially, so at most this many threads work for the caller.
+inline int& local_max_concurrency()
+{
+    static istThreadLocal int s_value = 0;
+    return s_value;
+}
+
+class scoped_max_concurrency
+{
+public:
+    // nested scopes can only lower the cap
+    scoped_max_concurrency(int v) : m_prev(local_max_concurrency()) { if (v > 0 && (m_prev <= 0 || v < m_prev)) { local_max_concurrency() = v; } }
+    ~scoped_max_concurrency() { local_max_concurrency() = m_prev; }
+private:
+    int m_prev;
+};
+
+namespace detail {
+
+// if loops are capped, split [first, last) into that many chunks at most and run them by run(num_chunks, f(chunk)).
+template<class IndexType, class Body, class Run>
+inline bool run_capped(IndexType first, IndexType last, const Body &body, const Run &run)
+{
+    int max_concurrency = local_max_concurrency();
+    if (max_concurrency <= 0 || first >= last) { return false; }
+    IndexType n = last - first;
+    IndexType chunk = n / max_concurrency + (n % max_concurrency == 0 ? 0 : 1);
+    int num_chunks = (int)(n / chunk + (n % chunk == 0 ? 0 : 1));
+    run(num_chunks, [&](int ci) {
+        scoped_max_concurrency nested(1);
+        IndexType beg = first + chunk * ci;
+        body(beg, std::min<IndexType>(beg + chunk, last));
+    });
+    return true;
+}
+
+} // namespace detail
+
+// work stealing scheduler. depends only on the standard library.
+// each thread has a bounded deque of tasks. owner pushes and pops at the bottom, idle threads steal from the top.
+// tasks of parallel_for and parallel_invoke are on the stack of the thread that splits the work, so they never allocate.
+namespace ws {
+
+class task
+{
+public:
+    task() : m_counter(nullptr) {}
+    virtual ~task() {}
+    virtual void execute() = 0;
+
+    // execute() may delete the task. counter is decremented after that. returns true if it reached 0.
+    // seq_cst, so scheduler::run() sees waiters that sleep on the counter.
+    bool run()
+    {
+        std::atomic<int> *counter = m_counter;
+        execute();
+        return counter->fetch_sub(1) == 1;
+    }
+
+    std::atomic<int> *m_counter;
+};
+
+// Chase-Lev deque of fixed capacity
+class task_deque
+{
+public:
+    static const int capacity = 1024;
+
+    task_deque() : m_top(0), m_bottom(0) {}
+
+    // owner only. returns false if full.
+    bool push(task *t)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t top = m_top.load(std::memory_order_acquire);
+        if (b - top >= capacity) { return false; }
+        m_tasks[b & (capacity - 1)].store(t, std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // owner only
+    task* pop()
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+        task *t = nullptr;
+        if (top <= b) {
+            t = m_tasks[b & (capacity - 1)].load(std::memory_order_relaxed);
+            if (top == b) {
+                // last task. thieves may be taking it.
+                if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    t = nullptr;
+                }
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    // any thread
+    task* steal()
+    {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (top >= b) { return nullptr; }
+        task *t = m_tasks[top & (capacity - 1)].load(std::memory_order_acquire);
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return t;
+    }
+
+private:
+    // top and bottom on separate cache lines. thieves write top, owner writes bottom.
+    std::atomic<int64_t> m_top;
+    char m_pad0[64 - sizeof(int64_t)];
+    std::atomic<int64_t> m_bottom;
+    char m_pad1[64 - sizeof(int64_t)];
+    std::atomic<task*> m_tasks[capacity];
+};
+
+// pool of worker threads. threads that are not workers (main thread etc.) get a deque on first use and help while waiting.
+// they give the deque back when they exit.
+class scheduler
+{
+public:
+    static const int max_external_threads = 16;
+    static const int default_spin_count = 64;
+
+    static scheduler& instance()
+    {
+        static scheduler s_instance;
+        return s_instance;
+    }
+
+    // workers + calling thread
+    int num_threads() const { return m_num_workers + 1; }
+
+    // restarts workers with new params. must be called while no tasks are running.
+    void configure(const threading_params &v)
+    {
+        stop_workers();
+        m_params = v;
+        start_workers();
+    }
+
+    // push a task to deque of calling thread. returns false if it has no deque or deque is full. caller must run it then.
+    bool push(task *t)
+    {
+        int slot = local_slot();
+        if (slot < 0 || !m_deques[slot].push(t)) { return false; }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_num_sleepers.load(std::memory_order_relaxed) > 0) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_epoch.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_cond.notify_one();
+        }
+        return true;
+    }
+
+    // run other tasks until counter reaches 0. sleeps like idle workers when there are none.
+    void wait(const std::atomic<int> &counter)
+    {
+        int slot = local_slot();
+        int spin_count = m_params.spin_count != 0 ? m_params.spin_count : default_spin_count;
+        int idle = 0;
+        while (counter.load(std::memory_order_acquire) != 0) {
+            if (task *t = take(slot)) {
+                run(t);
+                idle = 0;
+                continue;
+            }
+            if (spin_count < 0 || ++idle < spin_count) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // sleep until a task is pushed or counter reaches 0. run() sees m_num_waiters after counter is decremented, or this sees counter.
+            idle = 0;
+            uint32_t epoch = m_epoch.load();
+            m_num_sleepers.fetch_add(1);
+            m_num_waiters.fetch_add(1);
+            task *t = counter.load() != 0 ? take(slot) : nullptr;
+            if (!t && counter.load() != 0) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [&]() { return m_epoch.load() != epoch || counter.load() == 0; });
+            }
+            m_num_waiters.fetch_sub(1);
+            m_num_sleepers.fetch_sub(1);
+            if (t) { run(t); }
+        }
+    }
+
+    // run a task of other thread. wakes sleeping waiters if its counter reached 0.
+    void run(task *t)
+    {
+        if (t->run() && m_num_waiters.load() > 0) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_epoch.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_cond.notify_all();
+        }
+    }
+
+private:
+    scheduler()
+        : m_num_workers(0), m_num_external(0), m_external_used(0), m_num_sleepers(0), m_num_waiters(0), m_epoch(0), m_quit(false)
+    {
+        start_workers();
+    }
+
+    ~scheduler()
+    {
+        stop_workers();
+    }
+
+    void start_workers()
+    {
+        int num_threads = m_params.num_threads > 0 ? m_params.num_threads : (int)std::thread::hardware_concurrency();
+        m_num_workers = std::max<int>(num_threads - 1, 0);
+        // external threads keep their slots across restarts
+        m_deques.reset(new task_deque[max_external_threads + m_num_workers]);
+        m_quit.store(false);
+        for (int i = 0; i < m_num_workers; ++i) {
+            m_workers.push_back(std::thread([this, i]() { worker_main(max_external_threads + i); }));
+        }
+    }
+
+    void stop_workers()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_quit.store(true);
+        }
+        m_cond.notify_all();
+        for (auto &t : m_workers) { t.join(); }
+        m_workers.clear();
+        m_num_workers = 0;
+    }
+
+    static int& thread_slot()
+    {
+        static istThreadLocal int s_slot = -1; // -1: no deque
+        return s_slot;
+    }
+
+    // releases external slot of its thread on exit. istThreadLocal can't run destructors.
+    struct external_slot_guard
+    {
+        scheduler *owner;
+        int slot;
+        external_slot_guard() : owner(nullptr), slot(-1) {}
+        ~external_slot_guard() { if (owner) { owner->m_external_used.fetch_and(~(1u << slot)); } }
+    };
+
+    // slots [0, max_external_threads) are for external threads, workers follow.
+    // threads beyond max_external_threads get no deque and run their tasks inline, until a slot is released.
+    int local_slot()
+    {
+        int &slot = thread_slot();
+        if (slot < 0) {
+            slot = acquire_external_slot();
+        }
+        return slot;
+    }
+
+    int acquire_external_slot()
+    {
+        uint32_t used = m_external_used.load(std::memory_order_relaxed);
+        for (;;) {
+            int i = 0;
+            while (i < max_external_threads && (used & (1u << i)) != 0) { ++i; }
+            if (i == max_external_threads) { return -1; }
+            if (m_external_used.compare_exchange_weak(used, used | (1u << i))) {
+                // thieves scan slots up to the highest one ever used
+                int num = m_num_external.load();
+                while (num < i + 1 && !m_num_external.compare_exchange_weak(num, i + 1)) {}
+
+                static thread_local external_slot_guard s_guard;
+                s_guard.owner = this;
+                s_guard.slot = i;
+                return i;
+            }
+        }
+    }
+
+    task* take(int slot)
+    {
+        if (slot >= 0) {
+            if (task *t = m_deques[slot].pop()) { return t; }
+        }
+        static istThreadLocal uint32_t s_seed = 0;
+        uint32_t &seed = s_seed;
+        seed = seed * 1664525u + 1013904223u;
+
+        int num_external = m_num_external.load(std::memory_order_relaxed);
+        int num = num_external + m_num_workers;
+        if (num == 0) { return nullptr; }
+        int start = int((seed >> 8) % (uint32_t)num);
+        for (int i = 0; i < num; ++i) {
+            int v = start + i < num ? start + i : start + i - num;
+            int victim = v < num_external ? v : max_external_threads + (v - num_external);
+            if (victim == slot) { continue; }
+            if (task *t = m_deques[victim].steal()) { return t; }
+        }
+        return nullptr;
+    }
+
+    void worker_main(int slot)
+    {
+        thread_slot() = slot;
+        if (m_params.affinity_mask != 0) { set_thread_affinity(m_params.affinity_mask); }
+        if (m_params.priority != 0) { set_thread_priority(m_params.priority); }
+
+        int spin_count = m_params.spin_count != 0 ? m_params.spin_count : default_spin_count;
+        int idle = 0;
+        while (!m_quit.load(std::memory_order_relaxed)) {
+            if (task *t = take(slot)) {
+                run(t);
+                idle = 0;
+                continue;
+            }
+            if (spin_count < 0 || ++idle < spin_count) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // sleep until a task is pushed. push() sees m_num_sleepers after its task is visible, or this sees the task.
+            idle = 0;
+            uint32_t epoch = m_epoch.load();
+            m_num_sleepers.fetch_add(1);
+            if (task *t = take(slot)) {
+                m_num_sleepers.fetch_sub(1);
+                run(t);
+                continue;
+            }
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [&]() { return m_epoch.load() != epoch || m_quit.load(); });
+            }
+            m_num_sleepers.fetch_sub(1);
+        }
+    }
+
+    threading_params m_params;
+    int m_num_workers;
+    std::unique_ptr<task_deque[]> m_deques; // external threads, then workers
+    std::vector<std::thread> m_workers;
+    std::atomic<int> m_num_external;      // external slots ever used
+    std::atomic<uint32_t> m_external_used; // bit of each external slot held by a live thread
+    std::atomic<int> m_num_sleepers;
+    std::atomic<int> m_num_waiters;       // threads sleeping in wait()
+    std::atomic<uint32_t> m_epoch;
+    std::atomic<bool> m_quit;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+// task that refers to a functor on the stack of its spawner
+template<class Func>
+class function_task : public task
+{
+public:
+    function_task(const Func &f) : m_func(f) {}
+    void execute() override { m_func(); }
+private:
+    const Func &m_func;
+};
+
+// task that owns a copy of its functor. deletes itself when done.
+template<class Func>
+class heap_task : public task
+{
+public:
+    heap_task(const Func &f) : m_func(f) {}
+    void execute() override { m_func(); delete this; }
+private:
+    Func m_func;
+};
+
+// calls f(begin, end) for subranges of [first, last) no larger than grain.
+// range is halved recursively. right halves are pushed as tasks, left halves run on this thread.
+template<class IndexType, class Func>
+inline void split_range(IndexType first, IndexType last, IndexType grain, const Func &f)
+{
+    scheduler &s = scheduler::instance();
+    if (last - first <= grain || s.num_threads() == 1) {
+        f(first, last);
+        return;
+    }
+    IndexType mid = first + (last - first) / 2;
+    auto right = [&]() { split_range(mid, last, grain, f); };
+    std::atomic<int> pending(1);
+    function_task<decltype(right)> t(right);
+    t.m_counter = &pending;
+    if (!s.push(&t)) {
+        split_range(first, mid, grain, f);
+        t.run();
+        return;
+    }
+    split_range(first, mid, grain, f);
+    s.wait(pending);
+}
+
+template<class Body>
+inline void run_chunks(int num_chunks, const Body &body)
+{
+    split_range(0, num_chunks, 1, [&](int beg, int end) {
+        for (int i = beg; i < end; ++i) { body(i); }
+    });
+}
+
+template<class IndexType, class IntType, class Body>
+inline void parallel_for_blocked(IndexType first, IndexType last, IntType granularity, const Body& body)
+{
+    if (first >= last) { return; }
+    if (detail::run_capped(first, last, body, [](int n, const std::function<void(int)> &f) { run_chunks(n, f); })) { return; }
+    split_range(first, last, std::max<IndexType>((IndexType)granularity, 1), body);
+}
 
 template<class IndexType, class Body>
 inline void parallel_for(IndexType first, IndexType last, const Body& body)
 {
-    tbb::parallel_for(first, last, body);
+    if (first >= last) { return; }
+    if (local_max_concurrency() > 0) {
+        parallel_for_blocked(first, last, 1, [&](IndexType beg, IndexType end) {
+            for (IndexType i = beg; i < end; ++i) { body(i); }
+        });
+        return;
+    }
+    // 8 chunks per thread leave room for stealing when chunks are uneven
+    IndexType grain = std::max<IndexType>((last - first) / (scheduler::instance().num_threads() * 8), 1);
+    split_range(first, last, grain,
+        [&](IndexType beg, IndexType end) {
+            for (IndexType i = beg; i < end; ++i) { body(i); }
+        });
 }
 
 template<class IndexType, class IntType, class Body>
 inline void parallel_for(IndexType first, IndexType last, IntType granularity, const Body& body)
 {
-    typedef tbb::blocked_range<IndexType> range_t;
-    tbb::parallel_for(range_t(first, last, granularity),
-        [&](const range_t &r) {
-            for (int i = r.begin(); i < r.end(); ++i) { body(i); }
+    parallel_for_blocked(first, last, granularity,
+        [&](IndexType beg, IndexType end) {
+            for (IndexType i = beg; i < end; ++i) { body(i); }
         });
 }
 
+template<class Func>
+inline void parallel_invoke(const Func &f)
+{
+    f();
+}
+
+template<class Func, class... Rest>
+inline void parallel_invoke(const Func &f, const Rest&... rest)
+{
+    std::atomic<int> pending(1);
+    function_task<Func> t(f);
+    t.m_counter = &pending;
+    scheduler &s = scheduler::instance();
+    if (!s.push(&t)) {
+        t.run();
+        parallel_invoke(rest...);
+        return;
+    }
+    parallel_invoke(rest...);
+    s.wait(pending);
+}
+
+// quicksort. both sides of each partition are sorted in parallel, small ranges by std::sort.
+template<class RandomIt, class Compare>
+inline void parallel_sort(RandomIt first, RandomIt last, const Compare &comp)
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+    const ptrdiff_t min_size = 4096;
+    if (last - first <= min_size || scheduler::instance().num_threads() == 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    // median of three. elements equal to pivot go to the middle and are not sorted again.
+    const value_type &a = *first, &b = *(first + (last - first) / 2), &c = *(last - 1);
+    value_type pivot = comp(a, b) ?
+        (comp(b, c) ? b : (comp(a, c) ? c : a)) :
+        (comp(a, c) ? a : (comp(b, c) ? c : b));
+    RandomIt mid1 = std::partition(first, last, [&](const value_type &v) { return comp(v, pivot); });
+    RandomIt mid2 = std::partition(mid1, last, [&](const value_type &v) { return !comp(pivot, v); });
+    parallel_invoke(
+        [&]() { parallel_sort(first, mid1, comp); },
+        [&]() { parallel_sort(mid2, last, comp); });
+}
+
+template<class RandomIt>
+inline void parallel_sort(RandomIt first, RandomIt last)
+{
+    parallel_sort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+class task_group
+{
+public:
+    task_group() : m_pending(0) {}
+    ~task_group() { wait(); }
+
+    template<class Func>
+    void run(const Func &f)
+    {
+        heap_task<Func> *t = new heap_task<Func>(f);
+        t->m_counter = &m_pending;
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        // other threads may wait for this group, so run it through the scheduler to wake them
+        scheduler &s = scheduler::instance();
+        if (!s.push(t)) { s.run(t); }
+    }
+
+    void wait() { scheduler::instance().wait(m_pending); }
+
+private:
+    task_group(const task_group&);
+    task_group& operator=(const task_group&);
+
+    std::atomic<int> m_pending;
+};
+
+} // namespace ws
+
+
+#if defined(istWithWorkStealing)
+
+using ws::parallel_for;
+using ws::parallel_for_blocked;
+using ws::parallel_sort;
+using ws::parallel_invoke;
+using ws::task_group;
+
+inline const char* backend_name() { return "work stealing"; }
+inline int num_threads() { return ws::scheduler::instance().num_threads(); }
+
+// restarts workers. must be called while no parallel work is running.
+inline void set_threading_params(const threading_params &v)
+{
+    ws::scheduler::instance().configure(v);
+}
+
+
+#elif defined(mpWithTBB)
+
 template<class IndexType, class IntType, class Body>
 inline void parallel_for_blocked(IndexType first, IndexType last, IntType granularity, const Body& body)
 {
+    auto run_chunks = [](int n, const std::function<void(int)> &f) { tbb::parallel_for(0, n, f); };
+    if (detail::run_capped(first, last, body, run_chunks)) { return; }
     typedef tbb::blocked_range<IndexType> range_t;
     tbb::parallel_for(range_t(first, last, granularity), [&](const range_t &r) { body(r.begin(), r.end()); });
 }
 
+template<class IndexType, class Body>
+inline void parallel_for(IndexType first, IndexType last, const Body& body)
+{
+    if (local_max_concurrency() > 0) {
+        parallel_for_blocked(first, last, 1, [&](IndexType beg, IndexType end) {
+            for (IndexType i = beg; i < end; ++i) { body(i); }
+        });
+        return;
+    }
+    tbb::parallel_for(first, last, body);
+}
+
+template<class IndexType, class IntType, class Body>
+inline void parallel_for(IndexType first, IndexType last, IntType granularity, const Body& body)
+{
+    parallel_for_blocked(first, last, granularity,
+        [&](IndexType beg, IndexType end) {
+            for (IndexType i = beg; i < end; ++i) { body(i); }
+        });
+}
+
 
 using tbb::parallel_sort;
 using tbb::parallel_invoke;
 using tbb::task_group;
 using tbb::combinable;
 
+inline const char* backend_name() { return "TBB"; }
+#if TBB_INTERFACE_VERSION >= 9100
+inline int num_threads() { return tbb::this_task_arena::max_concurrency(); }
+#else
+inline int num_threads() { return tbb::task_scheduler_init::default_num_threads(); }
+#endif
 
-#elif _WIN32
+namespace detail {
 
-template<class IndexType, class Body>
-inline void parallel_for(IndexType first, IndexType last, const Body& body)
+// applies affinity and priority to threads that join the TBB scheduler
+class tbb_thread_observer : public tbb::task_scheduler_observer
 {
-    concurrency::parallel_for(first, last, body);
-}
+public:
+    tbb_thread_observer(const threading_params &v) : m_params(v) { observe(true); }
+    ~tbb_thread_observer() { observe(false); }
 
-template<class IndexType, class IntType, class Body>
-inline void parallel_for(IndexType first, IndexType last, IntType granularity, const Body& body)
+    void on_scheduler_entry(bool is_worker) override
+    {
+        if (!is_worker) { return; }
+        if (m_params.affinity_mask != 0) { set_thread_affinity(m_params.affinity_mask); }
+        if (m_params.priority != 0) { set_thread_priority(m_params.priority); }
+    }
+
+private:
+    threading_params m_params;
+};
+
+} // namespace detail
+
+// TBB manages spinning of its workers, so spin_count is ignored.
+// affinity and priority are applied to workers as they enter the scheduler.
+inline void set_threading_params(const threading_params &v)
 {
-    concurrency::parallel_for(first, last, granularity, [&](int i) {
-        IndexType beg = i;
-        IndexType end = std::min<IndexType>(beg + granularity, last);
-        for (int i = beg; i < end; ++i) { body(i); }
-    });
+#if TBB_INTERFACE_VERSION >= 11000
+    static std::unique_ptr<tbb::global_control> s_control;
+    s_control.reset();
+    if (v.num_threads > 0) {
+        s_control.reset(new tbb::global_control(tbb::global_control::max_allowed_parallelism, v.num_threads));
+    }
+#else
+    static std::unique_ptr<tbb::task_scheduler_init> s_init;
+    s_init.reset();
+    s_init.reset(new tbb::task_scheduler_init(v.num_threads > 0 ? v.num_threads : tbb::task_scheduler_init::automatic));
+#endif
+    static std::unique_ptr<detail::tbb_thread_observer> s_observer;
+    s_observer.reset();
+    if (v.affinity_mask != 0 || v.priority != 0) {
+        s_observer.reset(new detail::tbb_thread_observer(v));
+    }
 }
 
+
+#else
+
 template<class IndexType, class IntType, class Body>
 inline void parallel_for_blocked(IndexType first, IndexType last, IntType granularity, const Body& body)
 {
+    auto run_chunks = [](int n, const std::function<void(int)> &f) { concurrency::parallel_for(0, n, f); };
+    if (detail::run_capped(first, last, body, run_chunks)) { return; }
     concurrency::parallel_for(first, last, granularity, [&](int i) {
         IndexType beg = i;
         IndexType end = std::min<IndexType>(beg + granularity, last);
@@ -143,11 +811,57 @@ inline void parallel_for_blocked(IndexType first, IndexType last, IntType granul
     });
 }
 
+template<class IndexType, class Body>
+inline void parallel_for(IndexType first, IndexType last, const Body& body)
+{
+    if (local_max_concurrency() > 0) {
+        parallel_for_blocked(first, last, 1, [&](IndexType beg, IndexType end) {
+            for (IndexType i = beg; i < end; ++i) { body(i); }
+        });
+        return;
+    }
+    concurrency::parallel_for(first, last, body);
+}
+
+template<class IndexType, class IntType, class Body>
+inline void parallel_for(IndexType first, IndexType last, IntType granularity, const Body& body)
+{
+    parallel_for_blocked(first, last, granularity,
+        [&](IndexType beg, IndexType end) {
+            for (IndexType i = beg; i < end; ++i) { body(i); }
+        });
+}
+
 
 using concurrency::parallel_sort;
 using concurrency::parallel_invoke;
 using concurrency::task_group;
 
+inline const char* backend_name() { return "PPL"; }
+inline int num_threads()
+{
+    int r = concurrency::CurrentScheduler::GetNumberOfVirtualProcessors();
+    return r > 0 ? r : (int)concurrency::GetProcessorCount();
+}
+
+// policy of the default scheduler can be set only before it is created, i.e. before first parallel work.
+// PPL has no affinity or spin control, so affinity_mask and spin_count are ignored.
+inline void set_threading_params(const threading_params &v)
+{
+    try {
+        concurrency::SchedulerPolicy policy;
+        if (v.num_threads > 0) {
+            policy.SetConcurrencyLimits(1, v.num_threads);
+        }
+        policy.SetPolicyValue(concurrency::ContextPriority, std::min<int>(std::max<int>(v.priority, -2), 2));
+        concurrency::Scheduler::SetDefaultSchedulerPolicy(policy);
+    }
+    catch (...) {}
+}
+
+#endif
+
+#if defined(istWithWorkStealing) || !defined(mpWithTBB)
 
 template<class T>
 class combinable : public tls<T>
@@ -158,10 +872,299 @@ public:
     template<class Body>
     void combine_each(const Body& body)
     {
-        for (auto p : m_locals) { body(*p); }
+        for (auto p : this->m_locals) { body(*p); }
     }
 };
 
-#endif // WithTBB
+#endif
+
+
+// LSD radix sort for (key, value) pairs. only lower key_bits bits of keys are considered.
+// result is stored in keys & values. tmp_keys & tmp_values are work area and must have num elements.
+// digit width is chosen from key_bits (up to 11 bits per pass), so narrow keys need fewer passes.
+template<class ValueType>
+inline void parallel_radix_sort(uint32_t *keys, ValueType *values, uint32_t *tmp_keys, ValueType *tmp_values, int num, int key_bits)
+{
+    const int max_digit_bits = 11;
+    const int min_block_size = 4096;
+    const int max_blocks = 64;
+    if (num <= 1 || key_bits <= 0) { return; }
+
+    int num_passes = (key_bits + max_digit_bits - 1) / max_digit_bits;
+    int digit_bits = (key_bits + num_passes - 1) / num_passes;
+    int num_buckets = 1 << digit_bits;
+    uint32_t digit_mask = num_buckets - 1;
+    int block_size = std::max<int>(min_block_size, (num + max_blocks - 1) / max_blocks);
+    int num_blocks = (num + block_size - 1) / block_size;
+
+    std::vector<int> offsets(num_blocks * num_buckets);
+    uint32_t *src_keys = keys, *dst_keys = tmp_keys;
+    ValueType *src_values = values, *dst_values = tmp_values;
+    for (int pass = 0; pass < num_passes; ++pass) {
+        int shift = pass * digit_bits;
+
+        // count digits of each block
+        parallel_for(0, num_blocks, [&](int bi) {
+            int *counts = &offsets[bi * num_buckets];
+            std::fill(counts, counts + num_buckets, 0);
+            int end = std::min<int>((bi + 1) * block_size, num);
+            for (int i = bi * block_size; i < end; ++i) {
+                ++counts[(src_keys[i] >> shift) & digit_mask];
+            }
+        });
+
+        // digit-major exclusive scan. blocks of the same digit are laid out in order, so the sort is stable.
+        int total = 0;
+        for (int d = 0; d < num_buckets; ++d) {
+            for (int bi = 0; bi < num_blocks; ++bi) {
+                int &o = offsets[bi * num_buckets + d];
+                int c = o;
+                o = total;
+                total += c;
+            }
+        }
+
+        // scatter
+        parallel_for(0, num_blocks, [&](int bi) {
+            int *dst = &offsets[bi * num_buckets];
+            int end = std::min<int>((bi + 1) * block_size, num);
+            for (int i = bi * block_size; i < end; ++i) {
+                int di = dst[(src_keys[i] >> shift) & digit_mask]++;
+                dst_keys[di] = src_keys[i];
+                dst_values[di] = src_values[i];
+            }
+        });
+
+        std::swap(src_keys, dst_keys);
+        std::swap(src_values, dst_values);
+    }
+
+    // odd number of passes: result is in work area
+    if (src_keys != keys) {
+        parallel_for(0, num_blocks, [&](int bi) {
+            int beg = bi * block_size;
+            int n = std::min<int>(block_size, num - beg);
+            memcpy(keys + beg, src_keys + beg, sizeof(uint32_t) * n);
+            memcpy(values + beg, src_values + beg, sizeof(ValueType) * n);
+        });
+    }
+}
+
+// blocked exclusive prefix sum. get(i) returns value of i-th element and set(i, offset) receives sum of elements before i.
+// get() is called twice for each element (block sums, then offsets), so it must be cheap and return the same value.
+// returns sum of all elements.
+template<class T, class Get, class Set>
+inline T parallel_scan(int num, const Get &get, const Set &set)
+{
+    const int min_block_size = 4096;
+    const int max_blocks = 256;
+    if (num <= 0) { return T(); }
+
+    int block_size = std::max<int>(min_block_size, (num + max_blocks - 1) / max_blocks);
+    int num_blocks = (num + block_size - 1) / block_size;
+    if (num_blocks == 1) {
+        T total = T();
+        for (int i = 0; i < num; ++i) {
+            T v = get(i);
+            set(i, total);
+            total += v;
+        }
+        return total;
+    }
+
+    // sum of each block
+    std::vector<T> offsets(num_blocks);
+    parallel_for(0, num_blocks, [&](int bi) {
+        int end = std::min<int>((bi + 1) * block_size, num);
+        T sum = T();
+        for (int i = bi * block_size; i < end; ++i) { sum += get(i); }
+        offsets[bi] = sum;
+    });
+
+    T total = T();
+    for (int bi = 0; bi < num_blocks; ++bi) {
+        T sum = offsets[bi];
+        offsets[bi] = total;
+        total += sum;
+    }
+
+    // scan each block from its offset
+    parallel_for(0, num_blocks, [&](int bi) {
+        int end = std::min<int>((bi + 1) * block_size, num);
+        T o = offsets[bi];
+        for (int i = bi * block_size; i < end; ++i) {
+            T v = get(i);
+            set(i, o);
+            o += v;
+        }
+    });
+    return total;
+}
+
+// in-place exclusive prefix sum of data. returns sum of all elements.
+template<class T>
+inline T parallel_scan(T *data, int num)
+{
+    return parallel_scan<T>(num,
+        [&](int i) { return data[i]; },
+        [&](int i, T o) { data[i] = o; });
+}
+
+// merge two sequences sorted by (key, value) into dst. on equal keys, smaller value comes first, so merging
+// index sequences gives same order as a stable sort of them would.
+// output is split into blocks and each block finds its start in a & b by binary search on the merge path.
+template<class ValueType>
+inline void parallel_merge(
+    const uint32_t *keys_a, const ValueType *values_a, int num_a,
+    const uint32_t *keys_b, const ValueType *values_b, int num_b,
+    uint32_t *dst_keys, ValueType *dst_values)
+{
+    const int min_block_size = 8192;
+    const int max_blocks = 64;
+    int num = num_a + num_b;
+    if (num == 0) { return; }
+
+    // a[ia] goes before b[ib]
+    auto a_first = [&](int ia, int ib) {
+        return keys_a[ia] < keys_b[ib] || (keys_a[ia] == keys_b[ib] && !(values_b[ib] < values_a[ia]));
+    };
+
+    int block_size = std::max<int>(min_block_size, (num + max_blocks - 1) / max_blocks);
+    int num_blocks = (num + block_size - 1) / block_size;
+    parallel_for(0, num_blocks, [&](int bi) {
+        int beg = bi * block_size;
+        int end = std::min<int>(beg + block_size, num);
+
+        // number of elements taken from a in the first 'beg' outputs
+        int lo = std::max<int>(0, beg - num_b);
+        int hi = std::min<int>(beg, num_a);
+        while (lo < hi) {
+            int ia = (lo + hi) / 2;
+            if (a_first(ia, beg - ia - 1)) { lo = ia + 1; }
+            else { hi = ia; }
+        }
+
+        int ia = lo;
+        int ib = beg - lo;
+        for (int i = beg; i < end; ++i) {
+            if (ib >= num_b || (ia < num_a && a_first(ia, ib))) {
+                dst_keys[i] = keys_a[ia];
+                dst_values[i] = values_a[ia];
+                ++ia;
+            }
+            else {
+                dst_keys[i] = keys_b[ib];
+                dst_values[i] = values_b[ib];
+                ++ib;
+            }
+        }
+    });
+}
+
+// runs body(i) for each node i in [0, num) of a dependency graph. node i starts once its num_preds[i] predecessors are done.
+// successors of node i are succs[succ_offsets[i], succ_offsets[i+1]).
+// a finished node runs one of its ready successors on the same thread, so chains of dependent nodes stay in cache.
+// if loops are capped by scoped_max_concurrency, that many loops take ready nodes from a shared stack instead.
+template<class Body>
+inline void parallel_graph(int num, const int *num_preds, const int *succ_offsets, const int *succs, const Body &body)
+{
+    if (num <= 0) { return; }
+
+    std::unique_ptr<std::atomic<int>[]> counters(new std::atomic<int>[num]);
+    for (int i = 0; i < num; ++i) { counters[i] = num_preds[i]; }
+
+    int max_concurrency = local_max_concurrency();
+    if (max_concurrency > 0) {
+        std::vector<int> ready;
+        std::mutex mutex;
+        std::atomic<int> num_left(num);
+        for (int i = 0; i < num; ++i) {
+            if (num_preds[i] == 0) { ready.push_back(i); }
+        }
+        parallel_for(0, max_concurrency, [&](int) {
+            while (num_left > 0) {
+                int i = -1;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (!ready.empty()) { i = ready.back(); ready.pop_back(); }
+                }
+                if (i < 0) {
+                    // predecessors are still running on other loops
+                    std::this_thread::yield();
+                    continue;
+                }
+                while (i >= 0) {
+                    body(i);
+                    int next = -1;
+                    for (int si = succ_offsets[i]; si < succ_offsets[i + 1]; ++si) {
+                        int s = succs[si];
+                        if (--counters[s] != 0) { continue; }
+                        if (next < 0) { next = s; }
+                        else {
+                            std::unique_lock<std::mutex> lock(mutex);
+                            ready.push_back(s);
+                        }
+                    }
+                    --num_left;
+                    i = next;
+                }
+            }
+        });
+        return;
+    }
+
+    task_group tasks;
+    std::function<void(int)> run = [&](int i) {
+        while (i >= 0) {
+            body(i);
+            int next = -1;
+            for (int si = succ_offsets[i]; si < succ_offsets[i + 1]; ++si) {
+                int s = succs[si];
+                if (--counters[s] != 0) { continue; }
+                if (next < 0) { next = s; }
+                else { tasks.run([&run, s]() { run(s); }); }
+            }
+            i = next;
+        }
+    };
+    for (int i = 0; i < num; ++i) {
+        if (num_preds[i] == 0) { tasks.run([&run, i]() { run(i); }); }
+    }
+    tasks.wait();
+}
+
+// lock free exchange of the latest value between one producer and one consumer.
+// producer fills back() and calls publish(). consumer calls acquire() and reads front() until next acquire().
+// the third slot is always free to swap with, so neither side waits for the other or touches its slot.
+template<class T>
+class triple_buffer
+{
+public:
+    triple_buffer() : m_back(0), m_ready(1), m_front(2) {}
+
+    // producer side
+    T& back() { return m_slots[m_back]; }
+    void publish()
+    {
+        m_back = m_ready.exchange(m_back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // consumer side. returns false and keeps front() if nothing was published since last acquire().
+    bool acquire()
+    {
+        if ((m_ready.load(std::memory_order_relaxed) & fresh_bit) == 0) { return false; }
+        m_front = m_ready.exchange(m_front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+    T& front() { return m_slots[m_front]; }
+    const T& front() const { return m_slots[m_front]; }
+
+private:
+    enum { index_mask = 3, fresh_bit = 4 };
+    T m_slots[3];
+    int m_back;
+    std::atomic<int> m_ready;
+    int m_front;
+};
 
 } // namespace ist
@@ -1,5 +1,8 @@
 #include "pch.h"
 #include "mpFoundation.h"
+#ifdef _MSC_VER
+#   include <intrin.h>
+#endif // _MSC_VER
 
 namespace {
     std::mt19937 g_rand;
@@ -22,7 +25,8 @@ void* mpAlignedAlloc(size_t size, size_t align)
 #ifdef _MSC_VER
     return _aligned_malloc(size, align);
 #elif defined(__APPLE__)
-    return malloc(size);
+    void *r = nullptr;
+    return posix_memalign(&r, align, size) == 0 ? r : nullptr;
 #else  // _MSC_VER
     return memalign(align, size);
 #endif // _MSC_VER
@@ -37,6 +41,68 @@ void mpAlignedFree(void *p)
 #endif // _MSC_VER
 }
 
+bool mpCPUHasAVX()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    // OS saves ymm registers (osxsave) and cpu has avx
+    const int osxsave_avx = (1 << 27) | (1 << 28);
+    if ((info[2] & osxsave_avx) != osxsave_avx) { return false; }
+    return (_xgetbv(0) & 6) == 6;
+#else  // _MSC_VER
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") != 0;
+#endif // _MSC_VER
+}
+
+
+// frames each candidate runs, and frames until tuning again
+static const int g_tuner_trial_frames = 4;
+static const int g_tuner_interval = 600;
+
+mpGrainTuner::mpGrainTuner(const int *candidates, int num_candidates, int initial)
+    : m_candidates(candidates, candidates + num_candidates)
+    , m_times(num_candidates)
+    , m_best(initial)
+    , m_trial(0)
+    , m_frame(0)
+    , m_load(0)
+{
+}
+
+int mpGrainTuner::get() const
+{
+    return m_candidates[m_trial >= 0 ? m_trial : m_best];
+}
+
+void mpGrainTuner::feed(float time, int load)
+{
+    if (m_trial < 0) {
+        // tune again if load changed more than 2x since last tuning
+        if (++m_frame < g_tuner_interval && load <= m_load * 2 && load * 2 >= m_load) { return; }
+        reset();
+        // this frame ran with the old grain. measuring starts next frame.
+        return;
+    }
+    // minimum of a few frames filters out preemption and cache warm up
+    float &t = m_times[m_trial];
+    t = m_frame == 0 ? time : std::min<float>(t, time);
+    if (++m_frame < g_tuner_trial_frames) { return; }
+    m_frame = 0;
+    if (++m_trial < (int)m_candidates.size()) { return; }
+
+    m_trial = -1;
+    m_best = (int)(std::min_element(m_times.begin(), m_times.end()) - m_times.begin());
+    m_load = load;
+}
+
+void mpGrainTuner::reset()
+{
+    m_trial = 0;
+    m_frame = 0;
+}
+
 
 void mpSoAData::resize(size_t n)
 {
@@ -53,4 +119,8 @@ void mpSoAData::resize(size_t n)
     density.resize(n);
     affection.resize(n);
     hit.resize(n);
+    lifetime.resize(n);
+    id.resize(n);
+    userdata.resize(n);
+    hit_prev.resize(n);
 }
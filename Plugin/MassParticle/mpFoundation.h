@@ -8,6 +8,8 @@
 #   define mpCountof(exp) (sizeof(exp)/sizeof(exp[0]))
 #endif
 
+typedef int8_t          i8;
+typedef uint8_t         u8;
 typedef int16_t         i16;
 typedef uint16_t        u16;
 typedef int32_t         i32;
@@ -83,6 +85,9 @@ float mpGenRand();
 // 0.0f-1.0f
 float mpGenRand1();
 
+// AVX paths of SoA conversion are used only if this returns true
+bool mpCPUHasAVX();
+
 
 struct mpKernelParams : ispc::KernelParams
 {
@@ -92,6 +97,8 @@ struct mpKernelParams : ispc::KernelParams
         (vec3&)world_extent = vec3(10.24f, 10.24f, 10.24f);
         (ivec3&)world_div = ivec3(128, 128, 128);
         (vec3&)coord_scaler = vec3(1.0f, 1.0f, 1.0f);
+        (vec3&)active_region_center = (vec3&)world_center;
+        (vec3&)active_region_extent = (vec3&)world_extent;
 
         solver_type = 0; // mpSolverType_Impulse
         enable_interaction = 1;
@@ -110,9 +117,51 @@ struct mpKernelParams : ispc::KernelParams
         SPHRestDensity = 1000.0f;
         SPHParticleMass = 0.002f;
         SPHViscosity = 0.1f;
+
+        enable_incremental_sort = 0;
+        enable_persistent_soa = 0;
+        enable_sparse_grid = 0;
+        cell_ordering = 0; // mpCellOrdering_Linear
+        enable_row_spans = 0;
+        enable_half_shell = 0;
+        enable_neighbor_lists = 0;
+        neighbor_list_skin = 0.04f;
+        particle_parallel_threshold = 0;
+        soa_block_size = 0;
+        enable_fused_update = 0;
+        enable_task_graph = 0;
+        max_threads = 0;
+        enable_grain_tuning = 0;
+        dense_cell_threshold = 0;
+        enable_pipelined_update = 0;
+        data_texture_layout = 0; // mpDataTextureLayout_Full
     }
 };
 
+const int mpMaxWorldDiv = 1024;
+
+// wall time of each phase of last update in milliseconds
+struct mpPhaseTimings
+{
+    float sort;             // hash and sort
+    float cells;            // cell list and SoA layout
+    float soa;              // gather to SoA data
+    float neighbor_lists;
+    float kernels;          // interaction, forces, colliders and integration
+    float aos;              // SoA -> AoS
+    float gpu_copy;
+    float total;
+};
+
+// worker threads shared by all contexts
+struct mpThreadingParams
+{
+    i32 num_threads;        // 0: number of cores
+    uint64_t affinity_mask; // bit i: workers can run on core i. 0: any core
+    i32 priority;           // -2 (lowest) - 2 (highest)
+    i32 spin_count;         // 0: default, negative: idle workers never sleep
+};
+
 struct mpTempParams
 {
     vec3 cell_size;
@@ -120,6 +169,13 @@ struct mpTempParams
     vec3 world_bounds_bl;
     vec3 world_bounds_ur;
     ivec3 world_div_bits;
+
+    // key of cell (x, y, z) is cell_key_x[x] | cell_key_y[y] | cell_key_z[z]. layout depends on cell_ordering.
+    u32 cell_key_x[mpMaxWorldDiv];
+    u32 cell_key_y[mpMaxWorldDiv];
+    u32 cell_key_z[mpMaxWorldDiv];
+    // inverse of above: each 10 bits of key -> packed coordinate (x | y<<10 | z<<20)
+    u32 cell_key_decode[3][1024];
 };
 
 
@@ -199,7 +255,7 @@ void* mpAlignedAlloc(size_t size, size_t align);
 void mpAlignedFree(void *p);
 
 
-template<typename T, int Align=32>
+template<typename T, int Align=64>
 class mpAlignedAllocator {
 public:
     typedef T value_type;
@@ -230,10 +286,14 @@ template<class T, typename Alloc> inline bool operator!=(const mpAlignedAllocato
 
 typedef std::vector<float, mpAlignedAllocator<float> >                          mpFloatArray;
 typedef std::vector<int, mpAlignedAllocator<int> >                              mpIntArray;
+typedef std::vector<u8, mpAlignedAllocator<u8> >                                mpByteArray;
+typedef std::vector<i8, mpAlignedAllocator<i8> >                                mpInt8Array;
+typedef std::vector<u32, mpAlignedAllocator<u32> >                              mpUIntArray;
 typedef std::vector<mpParticle, mpAlignedAllocator<mpParticle> >                mpParticleCont;
 typedef std::vector<mpParticleIM, mpAlignedAllocator<mpParticleIM> >            mpParticleIMCont;
 typedef std::vector<mpParticleForce, mpAlignedAllocator<mpParticleForce> >      mpPForceCont;
 typedef std::vector<mpCell, mpAlignedAllocator<mpCell> >                            mpCellCont;
+typedef std::vector<ispc::vec3i, mpAlignedAllocator<ispc::vec3i> >                  mpCellIndexCont;
 typedef std::vector<mpColliderProperties*, mpAlignedAllocator<mpPlaneCollider> >    mpColliderPropertiesCont;
 typedef std::vector<mpPlaneCollider, mpAlignedAllocator<mpPlaneCollider> >      mpPlaneColliderCont;
 typedef std::vector<mpSphereCollider, mpAlignedAllocator<mpSphereCollider> >    mpSphereColliderCont;
@@ -268,7 +328,91 @@ struct mpSoAData
     mpFloatArray affection;
     mpIntArray hit;
 
+    // used only when the SoA data is the persistent particle state (enable_persistent_soa)
+    mpFloatArray lifetime;
+    mpUIntArray id;
+    mpIntArray userdata;
+    mpIntArray hit_prev;
+
     void resize(size_t n);
 };
 
+// cached neighbor lists in CSR layout. neighbors of row b are indices[offsets[b], offsets[b+1]).
+// rows and neighbors are sorted particle indices of the frame the lists were built.
+struct mpNeighborLists
+{
+    mpIntArray offsets;
+    mpIntArray indices;
+    mpIntArray sorted;      // row -> current sorted particle index. -1 if the particle is dead.
+    mpIntArray slots;       // row -> current SoA index. -1 if the particle is dead.
+    mpIntArray work;
+    mpFloatArray pos_x;     // positions at build
+    mpFloatArray pos_y;
+    mpFloatArray pos_z;
+    int num_rows;
+    float range;            // interaction range and skin the lists were built with
+    float skin;
+    bool valid;
+
+    mpNeighborLists() : num_rows(0), range(0.0f), skin(0.0f), valid(false) {}
+};
+
+// picks the fastest of candidate grain sizes by measurement.
+// each candidate runs a few frames and the fastest is kept. tuning starts again after a while, or if the load changes much.
+class mpGrainTuner
+{
+public:
+    mpGrainTuner(const int *candidates, int num_candidates, int initial);
+    int  get() const;
+    // time taken by the work that used get() this frame, and amount of the work (number of particles etc.)
+    void feed(float time, int load);
+    void reset();
+
+private:
+    std::vector<int> m_candidates;
+    std::vector<float> m_times;     // best time of each candidate in this round
+    int m_best;
+    int m_trial;                    // candidate being measured. -1: not tuning
+    int m_frame;
+    int m_load;                     // load when last tuned
+};
+
+// particles for rendering. update publishes one each frame and render thread takes the latest.
+struct mpRenderSnapshot
+{
+    mpByteArray             data;           // particles in data texture layout. whole lines. [num_particles, capacity) have zero lifetime.
+    int                     layout;         // mpDataTextureLayout
+    int                     num_particles;
+
+    mpRenderSnapshot() : layout(0), num_particles(0) {}
+};
+
+// particle modified by handler while update is in flight. words that differ from base are written to the new state.
+struct mpParticleEdit
+{
+    mpParticle base;
+    mpParticle edited;
+};
+typedef std::vector<mpParticleEdit, mpAlignedAllocator<mpParticleEdit> > mpParticleEditCont;
+
+// pipelined update: a finished state of a world. the game thread reads particles, scans and calls handlers on it
+// while the next state is simulated. particles are in cell order. cells are the occupied ones, in key order.
+struct mpGeneration
+{
+    mpKernelParams          kparams;
+    mpTempParams            tparams;
+    mpPhaseTimings          timings;
+    int                     num_particles;
+    mpParticleCont          particles;
+    mpParticleIMCont        imd;
+    mpCellCont              cells;
+    mpUIntArray             cell_keys;
+    mpPlaneColliderCont     plane_colliders;
+    mpSphereColliderCont    sphere_colliders;
+    mpCapsuleColliderCont   capsule_colliders;
+    mpBoxColliderCont       box_colliders;
+
+    mpGeneration() : num_particles(0) {}
+};
+
 class mpWorld;
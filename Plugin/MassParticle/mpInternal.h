@@ -1,8 +1,5 @@
 #pragma once
 #define mpImpl
-#ifdef __linux__
-    #define mpWithTBB
-#endif
 
 #define mpLog(...)
 #define mpTraceFunc(...)
@@ -6,10 +6,9 @@
 #include "mpWorld.h"
 
 const int mpDataTextureWidth = 3072;
-const int mpDataTextureHeight = 256;
-const int mpTexelsEachParticle = 3;
-const int mpParticlesEachLine = mpDataTextureWidth / mpTexelsEachParticle;
+// unit of SoA <-> AoS conversion. spans of SoA data are padded to multiple of soa_block_size (8 or 16), so a unit never crosses a span.
 const i32 SOA_BOCK_SIZE = 8;
+static const bool g_soa_avx = mpCPUHasAVX();
 
 
 i32 soa_blocks(i32 i)
@@ -23,10 +22,10 @@ inline void simd_store(void *address, T v)
     _mm_store_ps((float*)address, (const simd128&)v);
 }
 
-void mpSoAnize(const mpCell &cell, const mpParticleCont &particles, mpSoAData &soa)
+void mpSoAnizeSSE(const mpCell &cell, const mpParticleCont &particles, mpSoAData &soa)
 {
     int num = cell.end - cell.begin;
-    i32 si = cell.soai * SOA_BOCK_SIZE;
+    i32 si = cell.soai;
     i32 blocks = soa_blocks(num);
     float *pos_x = &soa.pos_x[si];
     float *pos_y = &soa.pos_y[si];
@@ -68,10 +67,10 @@ void mpSoAnize(const mpCell &cell, const mpParticleCont &particles, mpSoAData &s
         simd_store(&hit[i + 4], _mm_set1_epi32(0));
     }
 }
-void mpAoSnize(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particles, mpParticleIMCont &im)
+void mpAoSnizeSSE(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particles, mpParticleIMCont &im)
 {
     int num = cell.end - cell.begin;
-    i32 si = cell.soai * SOA_BOCK_SIZE;
+    i32 si = cell.soai;
     i32 blocks = soa_blocks(num);
     const float *pos_x = &soa.pos_x[si];
     const float *pos_y = &soa.pos_y[si];
@@ -140,248 +139,1058 @@ void mpAoSnize(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particl
     }
 }
 
-
-inline u32 mpGenHash(mpWorld &world, const mpParticle &particle)
+void mpAoSnizeFullSSE(const mpCell &cell, const mpSoAData &soa, mpParticle *particles, mpParticleIM *im)
 {
-    const mpKernelParams &p = world.getKernelParams();
-    mpTempParams &t = world.getTempParams();
-    vec3 &bl = (vec3&)t.world_bounds_bl;
-    vec3 &rcpCell = (vec3&)t.rcp_cell_size;
-    vec3 &ppos = (vec3&)particle.position;
-
-    u32 xb = clamp<i32>(i32((ppos.x - bl.x)*rcpCell.x), 0, p.world_div.x - 1);
-    u32 zb = clamp<i32>(i32((ppos.z - bl.z)*rcpCell.z), 0, p.world_div.z - 1) << (t.world_div_bits.x);
-    u32 yb = clamp<i32>(i32((ppos.y - bl.y)*rcpCell.y), 0, p.world_div.y - 1) << (t.world_div_bits.x + t.world_div_bits.z);
-    u32 r = xb | zb | yb;
-    if (particle.lifetime <= 0.0f) { r |= 0x80000000; }
-    return r;
+    int num = cell.end - cell.begin;
+    i32 si = cell.soai;
+    i32 blocks = soa_blocks(num);
+    const float *pos_x = &soa.pos_x[si];
+    const float *pos_y = &soa.pos_y[si];
+    const float *pos_z = &soa.pos_z[si];
+    const float *vel_x = &soa.vel_x[si];
+    const float *vel_y = &soa.vel_y[si];
+    const float *vel_z = &soa.vel_z[si];
+    const float *acl_x = &soa.acl_x[si];
+    const float *acl_y = &soa.acl_y[si];
+    const float *acl_z = &soa.acl_z[si];
+    const float *speed = &soa.speed[si];
+    const float *density = &soa.density[si];
+    const int *hit = &soa.hit[si];
+    const float *lifetime = &soa.lifetime[si];
+    const u32 *id = &soa.id[si];
+    const int *userdata = &soa.userdata[si];
+    const int *hit_prev = &soa.hit_prev[si];
+
+    for (i32 bi = 0; bi < blocks; ++bi) {
+        i32 i = bi*SOA_BOCK_SIZE;
+        ist::vec4soa4 aos_pos[2] = {
+            ist::soa_transpose44(
+                _mm_load_ps(&pos_x[i + 0]),
+                _mm_load_ps(&pos_y[i + 0]),
+                _mm_load_ps(&pos_z[i + 0]),
+                _mm_load_ps((const float*)&id[i + 0])),
+            ist::soa_transpose44(
+                _mm_load_ps(&pos_x[i + 4]),
+                _mm_load_ps(&pos_y[i + 4]),
+                _mm_load_ps(&pos_z[i + 4]),
+                _mm_load_ps((const float*)&id[i + 4])),
+        };
+        ist::vec4soa4 aos_vel[2] = {
+            ist::soa_transpose44(
+                _mm_load_ps(&vel_x[i + 0]),
+                _mm_load_ps(&vel_y[i + 0]),
+                _mm_load_ps(&vel_z[i + 0]),
+                _mm_load_ps(&speed[i + 0])),
+            ist::soa_transpose44(
+                _mm_load_ps(&vel_x[i + 4]),
+                _mm_load_ps(&vel_y[i + 4]),
+                _mm_load_ps(&vel_z[i + 4]),
+                _mm_load_ps(&speed[i + 4])),
+        };
+
+        i32 pi = cell.begin + i;
+        i32 e = std::min<i32>(SOA_BOCK_SIZE, num - i);
+        for (i32 ei = 0; ei < e; ++ei) {
+            mpParticle &p = particles[pi + ei];
+            p.position = aos_pos[ei / 4][ei % 4];
+            p.velocity = aos_vel[ei / 4][ei % 4];
+            p.density = density[i + ei];
+            p.lifetime = lifetime[i + ei];
+            p.hit = (u16)hit[i + ei];
+            p.hit_prev = (u16)hit_prev[i + ei];
+            p.userdata = userdata[i + ei];
+        }
+        if (im) {
+            ist::vec4soa4 aos_acl[2] = {
+                ist::soa_transpose44(
+                    _mm_load_ps(&acl_x[i + 0]),
+                    _mm_load_ps(&acl_y[i + 0]),
+                    _mm_load_ps(&acl_z[i + 0]),
+                    _mm_set1_ps(0.0f)),
+                ist::soa_transpose44(
+                    _mm_load_ps(&acl_x[i + 4]),
+                    _mm_load_ps(&acl_y[i + 4]),
+                    _mm_load_ps(&acl_z[i + 4]),
+                    _mm_set1_ps(0.0f)),
+            };
+            for (i32 ei = 0; ei < e; ++ei) {
+                im[pi + ei].accel = aos_acl[ei / 4][ei % 4];
+            }
+        }
+    }
 }
 
-inline void mpGenIndex(mpWorld &world, u32 hash, ispc::vec3i &idx)
+// AVX versions of above. each block is converted by one 8 wide transpose.
+istAVXTarget void mpSoAnizeAVX(const mpCell &cell, const mpParticleCont &particles, mpSoAData &soa)
 {
-    const mpKernelParams &p = world.getKernelParams();
-    mpTempParams &t = world.getTempParams();
-    idx.x = hash & (p.world_div.x - 1);
-    idx.z = (hash >> (t.world_div_bits.x)) & (p.world_div.z - 1);
-    idx.y = (hash >> (t.world_div_bits.x + t.world_div_bits.z)) & (p.world_div.y - 1);
+    int num = cell.end - cell.begin;
+    i32 si = cell.soai;
+    i32 blocks = soa_blocks(num);
+    float *pos_x = &soa.pos_x[si];
+    float *pos_y = &soa.pos_y[si];
+    float *pos_z = &soa.pos_z[si];
+    float *vel_x = &soa.vel_x[si];
+    float *vel_y = &soa.vel_y[si];
+    float *vel_z = &soa.vel_z[si];
+    int *hit = &soa.hit[si];
+
+    ist::simdvec8 soav[3];
+    for (i32 bi = 0; bi < blocks; ++bi) {
+        i32 i = bi*SOA_BOCK_SIZE;
+        i32 pi = cell.begin + i;
+
+        ist::soa_transpose38(
+            particles[pi + 0].position, particles[pi + 1].position, particles[pi + 2].position, particles[pi + 3].position,
+            particles[pi + 4].position, particles[pi + 5].position, particles[pi + 6].position, particles[pi + 7].position,
+            soav);
+        _mm256_store_ps(&pos_x[i], soav[0]);
+        _mm256_store_ps(&pos_y[i], soav[1]);
+        _mm256_store_ps(&pos_z[i], soav[2]);
+        ist::soa_transpose38(
+            particles[pi + 0].velocity, particles[pi + 1].velocity, particles[pi + 2].velocity, particles[pi + 3].velocity,
+            particles[pi + 4].velocity, particles[pi + 5].velocity, particles[pi + 6].velocity, particles[pi + 7].velocity,
+            soav);
+        _mm256_store_ps(&vel_x[i], soav[0]);
+        _mm256_store_ps(&vel_y[i], soav[1]);
+        _mm256_store_ps(&vel_z[i], soav[2]);
+
+        _mm256_store_si256((__m256i*)&hit[i], _mm256_setzero_si256());
+    }
+    _mm256_zeroupper();
 }
 
+istAVXTarget void mpAoSnizeAVX(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particles, mpParticleIMCont &im)
+{
+    int num = cell.end - cell.begin;
+    i32 si = cell.soai;
+    i32 blocks = soa_blocks(num);
+    const float *pos_x = &soa.pos_x[si];
+    const float *pos_y = &soa.pos_y[si];
+    const float *pos_z = &soa.pos_z[si];
+    const float *vel_x = &soa.vel_x[si];
+    const float *vel_y = &soa.vel_y[si];
+    const float *vel_z = &soa.vel_z[si];
+    const float *acl_x = &soa.acl_x[si];
+    const float *acl_y = &soa.acl_y[si];
+    const float *acl_z = &soa.acl_z[si];
+    const float *speed = &soa.speed[si];
+    const float *density = &soa.density[si];
+    const int *hit = &soa.hit[si];
 
+    simd128 aos_pos[SOA_BOCK_SIZE];
+    simd128 aos_vel[SOA_BOCK_SIZE];
+    simd128 aos_acl[SOA_BOCK_SIZE];
+    for (i32 bi = 0; bi < blocks; ++bi) {
+        i32 i = bi*SOA_BOCK_SIZE;
+        ist::aos_transpose48(_mm256_load_ps(&pos_x[i]), _mm256_load_ps(&pos_y[i]), _mm256_load_ps(&pos_z[i]), _mm256_set1_ps(1.0f), aos_pos);
+        ist::aos_transpose48(_mm256_load_ps(&vel_x[i]), _mm256_load_ps(&vel_y[i]), _mm256_load_ps(&vel_z[i]), _mm256_load_ps(&speed[i]), aos_vel);
+        ist::aos_transpose48(_mm256_load_ps(&acl_x[i]), _mm256_load_ps(&acl_y[i]), _mm256_load_ps(&acl_z[i]), _mm256_setzero_ps(), aos_acl);
 
-static const int g_particles_par_task = 2048;
-static const int g_cells_par_task = 256;
+        i32 pi = cell.begin + i;
+        i32 e = std::min<i32>(SOA_BOCK_SIZE, num - i);
+        for (i32 ei = 0; ei < e; ++ei) {
+            u32 id = particles[pi + ei].id;
+            im[pi + ei].accel = aos_acl[ei];
+            particles[pi + ei].position = aos_pos[ei];
+            particles[pi + ei].velocity = aos_vel[ei];
+            particles[pi + ei].density = density[i + ei];
+            particles[pi + ei].hit_prev = particles[pi + ei].hit;
+            particles[pi + ei].hit = (u16)hit[i + ei];
+            particles[pi + ei].id = id;
+        }
+    }
+    _mm256_zeroupper();
+}
 
-mpWorld::mpWorld()
-    : m_id_seed(0)
-    , m_num_particles(0)
-    , m_has_hithandler(false)
-    , m_has_forcehandler(false)
-    , m_num_particles_gpu(0)
-    , m_num_particles_gpu_prev(0)
+istAVXTarget void mpAoSnizeFullAVX(const mpCell &cell, const mpSoAData &soa, mpParticle *particles, mpParticleIM *im)
 {
+    int num = cell.end - cell.begin;
+    i32 si = cell.soai;
+    i32 blocks = soa_blocks(num);
+    const float *pos_x = &soa.pos_x[si];
+    const float *pos_y = &soa.pos_y[si];
+    const float *pos_z = &soa.pos_z[si];
+    const float *vel_x = &soa.vel_x[si];
+    const float *vel_y = &soa.vel_y[si];
+    const float *vel_z = &soa.vel_z[si];
+    const float *acl_x = &soa.acl_x[si];
+    const float *acl_y = &soa.acl_y[si];
+    const float *acl_z = &soa.acl_z[si];
+    const float *speed = &soa.speed[si];
+    const float *density = &soa.density[si];
+    const int *hit = &soa.hit[si];
+    const float *lifetime = &soa.lifetime[si];
+    const u32 *id = &soa.id[si];
+    const int *userdata = &soa.userdata[si];
+    const int *hit_prev = &soa.hit_prev[si];
+
+    simd128 aos_pos[SOA_BOCK_SIZE];
+    simd128 aos_vel[SOA_BOCK_SIZE];
+    simd128 aos_acl[SOA_BOCK_SIZE];
+    for (i32 bi = 0; bi < blocks; ++bi) {
+        i32 i = bi*SOA_BOCK_SIZE;
+        ist::aos_transpose48(_mm256_load_ps(&pos_x[i]), _mm256_load_ps(&pos_y[i]), _mm256_load_ps(&pos_z[i]), _mm256_load_ps((const float*)&id[i]), aos_pos);
+        ist::aos_transpose48(_mm256_load_ps(&vel_x[i]), _mm256_load_ps(&vel_y[i]), _mm256_load_ps(&vel_z[i]), _mm256_load_ps(&speed[i]), aos_vel);
+
+        i32 pi = cell.begin + i;
+        i32 e = std::min<i32>(SOA_BOCK_SIZE, num - i);
+        for (i32 ei = 0; ei < e; ++ei) {
+            mpParticle &p = particles[pi + ei];
+            p.position = aos_pos[ei];
+            p.velocity = aos_vel[ei];
+            p.density = density[i + ei];
+            p.lifetime = lifetime[i + ei];
+            p.hit = (u16)hit[i + ei];
+            p.hit_prev = (u16)hit_prev[i + ei];
+            p.userdata = userdata[i + ei];
+        }
+        if (im) {
+            ist::aos_transpose48(_mm256_load_ps(&acl_x[i]), _mm256_load_ps(&acl_y[i]), _mm256_load_ps(&acl_z[i]), _mm256_setzero_ps(), aos_acl);
+            for (i32 ei = 0; ei < e; ++ei) {
+                im[pi + ei].accel = aos_acl[ei];
+            }
+        }
+    }
+    _mm256_zeroupper();
 }
 
-mpWorld::~mpWorld()
+// AoS -> SoA of positions and velocities. clears hit flags.
+void mpSoAnize(const mpCell &cell, const mpParticleCont &particles, mpSoAData &soa)
 {
-    endUpdate();
+    if (g_soa_avx) { mpSoAnizeAVX(cell, particles, soa); }
+    else           { mpSoAnizeSSE(cell, particles, soa); }
 }
 
-const mpKernelParams& mpWorld::getKernelParams() const  { return m_kparams; }
-
-void mpWorld::setKernelParams(const mpKernelParams &v)
+// SoA -> AoS of the fields kernels update. ids of particles are kept.
+void mpAoSnize(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particles, mpParticleIMCont &im)
 {
-    m_kparams = v;
-
-    if (m_kparams.max_particles != (int)m_particles.size()) {
-        mpParticle blank;
-        blank.lifetime = 0.0f;
+    if (g_soa_avx) { mpAoSnizeAVX(cell, soa, particles, im); }
+    else           { mpAoSnizeSSE(cell, soa, particles, im); }
+}
 
-        m_particles.resize(m_kparams.max_particles, blank);
-        m_num_particles = std::min<int>(m_num_particles, (int)m_kparams.max_particles);
-    }
+// SoA -> AoS including the fields that only persistent SoA data has (id, lifetime, etc). im can be null.
+void mpAoSnizeFull(const mpCell &cell, const mpSoAData &soa, mpParticle *particles, mpParticleIM *im)
+{
+    if (g_soa_avx) { mpAoSnizeFullAVX(cell, soa, particles, im); }
+    else           { mpAoSnizeFullSSE(cell, soa, particles, im); }
 }
 
-mpTempParams& mpWorld::getTempParams()  { return m_tparams; }
-const mpCellCont& mpWorld::getCells()   { return m_cells; }
 
-void mpWorld::forceSetNumParticles(int v)
+inline bool mpIsHalfLayout(int layout)
 {
-    v = std::min<int>(v, (int)m_kparams.max_particles);
-
-    if (v > m_num_particles) {
-        for (int i = m_num_particles; i < v; ++i) {
-            //m_particles[i].lifetime = 1.0f;
-        }
-    }
-    else if (v < m_num_particles) {
-        for (int i = v; i < m_num_particles; ++i) {
-            m_particles[i].lifetime = 0.0f;
-        }
-    }
+    return layout == (int)mpDataTextureLayout::Half || layout == (int)mpDataTextureLayout::PositionHalf;
+}
 
-    m_num_particles = std::min<int>(v, (int)m_kparams.max_particles);
+inline gi::TextureFormat mpGetDataTextureFormat(int layout)
+{
+    return mpIsHalfLayout(layout) ? gi::TextureFormat::RGBAf16 : gi::TextureFormat::RGBAf32;
 }
 
-int         mpWorld::getNumParticles() const { return m_num_particles; }
-mpParticle* mpWorld::getParticles() { return m_particles.data(); }
-int         mpWorld::getNumParticlesGPU() const { return m_num_particles_gpu; }
-mpParticle* mpWorld::getParticlesGPU() { return m_particles_gpu.data(); }
+inline int mpGetTexelsEachParticle(int layout)
+{
+    static const int s_texels[] = { 3, 2, 1, 1 };
+    return s_texels[layout];
+}
 
-mpParticleIM& mpWorld::getIntermediateData(int i) { return m_imd[i]; }
-mpParticleIM& mpWorld::getIntermediateData() { return m_imd[m_current]; }
+// bytes of each particle on data texture
+inline int mpGetRenderDataStride(int layout)
+{
+    return mpGetTexelsEachParticle(layout) * (int)gi::GraphicsInterface::GetTexelSize(mpGetDataTextureFormat(layout));
+}
 
-std::mutex& mpWorld::getMutex() { return m_mutex; }
+// 4 floats -> halves in low 16 bits of each lane. rounds to nearest. values below 2^-14 become 0, too large ones and nan inf.
+inline __m128i mpFloatToHalf4(__m128 v)
+{
+    __m128i x = _mm_castps_si128(v);
+    __m128i sign = _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(0x8000));
+    __m128i a = _mm_and_si128(x, _mm_set1_epi32(0x7fffffff));
+    // rebias exponent (127 -> 15) and round
+    __m128i h = _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(a, _mm_set1_epi32((127 - 15) << 23)), _mm_set1_epi32(0x1000)), 13);
+    __m128i too_small = _mm_cmplt_epi32(a, _mm_set1_epi32(0x38800000));
+    __m128i too_large = _mm_cmpgt_epi32(a, _mm_set1_epi32(0x477fefff));
+    h = _mm_andnot_si128(too_small, h);
+    h = _mm_or_si128(_mm_andnot_si128(too_large, h), _mm_and_si128(too_large, _mm_set1_epi32(0x7c00)));
+    return _mm_or_si128(h, sign);
+}
 
+// x | y<<16 for each lane, as halves
+inline __m128i mpPackHalf2(__m128 x, __m128 y)
+{
+    return _mm_or_si128(mpFloatToHalf4(x), _mm_slli_epi32(mpFloatToHalf4(y), 16));
+}
 
-void mpWorld::addParticles(mpParticle *p, size_t num)
+// 4 particles as SoA lanes
+struct mpRenderLanes
 {
-    num = std::min<size_t>(num, m_kparams.max_particles - m_num_particles);
-    for (int i = 0; i < (int)num; ++i) {
-        m_particles[m_num_particles + i] = p[i];
-    }
-    if (m_kparams.id_as_float) {
-        for (int i = 0; i < (int)num; ++i) {
-            (float&)m_particles[m_num_particles + i].id = float(++m_id_seed);
-        }
+    __m128 px, py, pz;
+    __m128 vx, vy, vz;
+    __m128 lifetime;
+    __m128i id;
+};
+
+// write first n (<= 4) particles of l to dst in layout other than Full
+inline void mpPackRenderData4(int layout, const mpRenderLanes &l, const vec3 &center, bool id_as_float, u8 *dst, int n)
+{
+    __m128i r[4];
+    if (layout == (int)mpDataTextureLayout::Position) {
+        __m128 t0 = l.px, t1 = l.py, t2 = l.pz, t3 = l.lifetime;
+        _MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+        r[0] = _mm_castps_si128(t0);
+        r[1] = _mm_castps_si128(t1);
+        r[2] = _mm_castps_si128(t2);
+        r[3] = _mm_castps_si128(t3);
     }
     else {
-        for (int i = 0; i < (int)num; ++i) {
-            m_particles[m_num_particles + i].id = ++m_id_seed;
+        // positions are relative to world center to keep precision of halves
+        __m128 px = _mm_sub_ps(l.px, _mm_set1_ps(center.x));
+        __m128 py = _mm_sub_ps(l.py, _mm_set1_ps(center.y));
+        __m128 pz = _mm_sub_ps(l.pz, _mm_set1_ps(center.z));
+        if (layout == (int)mpDataTextureLayout::PositionHalf) {
+            __m128i xy = mpPackHalf2(px, py);
+            __m128i zw = mpPackHalf2(pz, l.lifetime);
+            r[0] = _mm_unpacklo_epi32(xy, zw);
+            r[1] = _mm_unpackhi_epi32(xy, zw);
+        }
+        else {
+            // id is only a random seed for shaders. low bits of it are exact in half.
+            __m128i id = id_as_float ? _mm_cvttps_epi32(_mm_castsi128_ps(l.id)) : l.id;
+            __m128 seed = _mm_cvtepi32_ps(_mm_and_si128(id, _mm_set1_epi32(2047)));
+            __m128i pxy = mpPackHalf2(px, py);
+            __m128i pzw = mpPackHalf2(pz, seed);
+            __m128i vxy = mpPackHalf2(l.vx, l.vy);
+            __m128i vzw = mpPackHalf2(l.vz, l.lifetime);
+            __m128i p01 = _mm_unpacklo_epi32(pxy, pzw);
+            __m128i p23 = _mm_unpackhi_epi32(pxy, pzw);
+            __m128i v01 = _mm_unpacklo_epi32(vxy, vzw);
+            __m128i v23 = _mm_unpackhi_epi32(vxy, vzw);
+            r[0] = _mm_unpacklo_epi64(p01, v01);
+            r[1] = _mm_unpackhi_epi64(p01, v01);
+            r[2] = _mm_unpacklo_epi64(p23, v23);
+            r[3] = _mm_unpackhi_epi64(p23, v23);
         }
     }
-    m_num_particles += (int)num;
+    memcpy(dst, r, mpGetRenderDataStride(layout) * n);
 }
 
-void mpWorld::addPlaneColliders(mpPlaneCollider *col, size_t num)
+// SoA span -> render data in layout other than Full. dst is the whole render data.
+void mpPackRenderDataSoA(int layout, const mpCell &span, const mpSoAData &soa, const vec3 &center, bool id_as_float, u8 *dst)
 {
-    m_plane_colliders.insert(m_plane_colliders.end(), col, col + num);
+    int num = span.end - span.begin;
+    i32 si = span.soai;
+    size_t stride = mpGetRenderDataStride(layout);
+    for (int i = 0; i < num; i += 4) {
+        mpRenderLanes l;
+        l.px = _mm_load_ps(&soa.pos_x[si + i]);
+        l.py = _mm_load_ps(&soa.pos_y[si + i]);
+        l.pz = _mm_load_ps(&soa.pos_z[si + i]);
+        l.vx = _mm_load_ps(&soa.vel_x[si + i]);
+        l.vy = _mm_load_ps(&soa.vel_y[si + i]);
+        l.vz = _mm_load_ps(&soa.vel_z[si + i]);
+        l.lifetime = _mm_load_ps(&soa.lifetime[si + i]);
+        l.id = _mm_load_si128((const __m128i*)&soa.id[si + i]);
+        mpPackRenderData4(layout, l, center, id_as_float, dst + stride*(span.begin + i), std::min<int>(4, num - i));
+    }
 }
 
-void mpWorld::addSphereColliders(mpSphereCollider *col, size_t num)
+// particles [begin, end) -> render data in layout other than Full. dst is the whole render data.
+void mpPackRenderDataAoS(int layout, const mpParticle *particles, int begin, int end, const vec3 &center, bool id_as_float, u8 *dst)
 {
-    m_sphere_colliders.insert(m_sphere_colliders.end(), col, col + num);
+    size_t stride = mpGetRenderDataStride(layout);
+    for (int i = begin; i < end; i += 4) {
+        int n = std::min<int>(4, end - i);
+        const mpParticle *s[4];
+        for (int ei = 0; ei < 4; ++ei) { s[ei] = &particles[i + std::min<int>(ei, n - 1)]; }
+
+        // (position, id) and (velocity, speed) of each particle
+        __m128 p0 = _mm_loadu_ps((const float*)&s[0]->position);
+        __m128 p1 = _mm_loadu_ps((const float*)&s[1]->position);
+        __m128 p2 = _mm_loadu_ps((const float*)&s[2]->position);
+        __m128 p3 = _mm_loadu_ps((const float*)&s[3]->position);
+        __m128 v0 = _mm_loadu_ps((const float*)&s[0]->velocity);
+        __m128 v1 = _mm_loadu_ps((const float*)&s[1]->velocity);
+        __m128 v2 = _mm_loadu_ps((const float*)&s[2]->velocity);
+        __m128 v3 = _mm_loadu_ps((const float*)&s[3]->velocity);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+
+        mpRenderLanes l;
+        l.px = p0; l.py = p1; l.pz = p2;
+        l.vx = v0; l.vy = v1; l.vz = v2;
+        l.lifetime = _mm_setr_ps(s[0]->lifetime, s[1]->lifetime, s[2]->lifetime, s[3]->lifetime);
+        l.id = _mm_castps_si128(p3);
+        mpPackRenderData4(layout, l, center, id_as_float, dst + stride*i, n);
+    }
 }
 
-void mpWorld::addCapsuleColliders(mpCapsuleCollider *col, size_t num)
-{
-    m_capsule_colliders.insert(m_capsule_colliders.end(), col, col + num);
-}
 
-void mpWorld::addBoxColliders(mpBoxCollider *col, size_t num)
+// unclamped cell coordinate (sparse grid)
+inline ivec3 mpGenCellCoord(const mpTempParams &t, const vec3 &pos)
 {
-    m_box_colliders.insert(m_box_colliders.end(), col, col + num);
+    const float lim = float(1 << 30);
+    vec3 c = glm::clamp(glm::floor((pos - (vec3&)t.world_bounds_bl) * (vec3&)t.rcp_cell_size), vec3(-lim), vec3(lim));
+    return ivec3(c);
 }
 
-
-void mpWorld::removeCollider(mpColliderProperties &props)
+// build cell key tables of mpTempParams from world_div and cell_ordering
+inline void mpGenCellKeyTables(const mpKernelParams &p, mpTempParams &t)
 {
-    {
-        auto i = std::lower_bound(m_box_colliders.begin(), m_box_colliders.end(), props.owner_id,
-            [&](const mpBoxCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_box_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+    // axes in order of lower bits
+    u32 *keys[3] = { t.cell_key_x, t.cell_key_z, t.cell_key_y };
+    int divs[3] = { p.world_div.x, p.world_div.z, p.world_div.y };
+    int bits[3] = { t.world_div_bits.x, t.world_div_bits.z, t.world_div_bits.y };
+    int coord_shift[3] = { 0, 20, 10 }; // position in packed coordinate of cell_key_decode
+
+    // bit position in key of each bit of each axis
+    int bit_pos[3][10];
+    int n = 0;
+    if ((mpCellOrdering)p.cell_ordering == mpCellOrdering::Morton) {
+        for (int b = 0; b < 10; ++b) {
+            for (int a = 0; a < 3; ++a) {
+                if (b < bits[a]) { bit_pos[a][b] = n++; }
+            }
         }
     }
-    {
-        auto i = std::lower_bound(m_sphere_colliders.begin(), m_sphere_colliders.end(), props.owner_id,
-            [&](const mpSphereCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_sphere_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+    else {
+        for (int a = 0; a < 3; ++a) {
+            for (int b = 0; b < bits[a]; ++b) { bit_pos[a][b] = n++; }
         }
     }
-    {
-        auto i = std::lower_bound(m_capsule_colliders.begin(), m_capsule_colliders.end(), props.owner_id,
-            [&](const mpCapsuleCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_capsule_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+
+    memset(t.cell_key_decode, 0, sizeof(t.cell_key_decode));
+    for (int a = 0; a < 3; ++a) {
+        for (int v = 0; v < divs[a]; ++v) {
+            u32 key = 0;
+            for (int b = 0; b < bits[a]; ++b) {
+                if (v & (1 << b)) { key |= 1 << bit_pos[a][b]; }
+            }
+            keys[a][v] = key;
         }
-    }
-    {
-        auto i = std::lower_bound(m_plane_colliders.begin(), m_plane_colliders.end(), props.owner_id,
-            [&](const mpPlaneCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_plane_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+        for (int b = 0; b < bits[a]; ++b) {
+            int pos = bit_pos[a][b];
+            u32 *decode = t.cell_key_decode[pos / 10];
+            for (int v = 0; v < 1024; ++v) {
+                if (v & (1 << (pos % 10))) { decode[v] |= 1 << (coord_shift[a] + b); }
+            }
         }
     }
 }
 
+inline u32 mpGenCellKey(const mpKernelParams &p, const mpTempParams &t, const ivec3 &ci)
+{
+    return t.cell_key_x[ci.x & (p.world_div.x - 1)] | t.cell_key_y[ci.y & (p.world_div.y - 1)] | t.cell_key_z[ci.z & (p.world_div.z - 1)];
+}
 
-void mpWorld::addForces(mpForce *force, size_t num)
+// must be identical to CellKeyHash() in mpCore.ispc
+inline u32 mpCellKeyHash(u32 key)
 {
-    m_forces.insert(m_forces.end(), force, force + num);
+    u32 h = key * 0x9E3779B1u;
+    return h ^ (h >> 15);
 }
 
+inline u32 mpGenHash(const mpKernelParams &p, const mpTempParams &t, const vec3 &ppos, f32 lifetime)
+{
+    const vec3 &bl = (const vec3&)t.world_bounds_bl;
+    const vec3 &rcpCell = (const vec3&)t.rcp_cell_size;
+
+    ivec3 ci;
+    if (!p.enable_sparse_grid) {
+        ci.x = clamp<i32>(i32((ppos.x - bl.x)*rcpCell.x), 0, p.world_div.x - 1);
+        ci.z = clamp<i32>(i32((ppos.z - bl.z)*rcpCell.z), 0, p.world_div.z - 1);
+        ci.y = clamp<i32>(i32((ppos.y - bl.y)*rcpCell.y), 0, p.world_div.y - 1);
+    }
+    else {
+        // no clamp. mpGenCellKey() wraps around world_div
+        ci = mpGenCellCoord(t, ppos);
+    }
+    u32 r = mpGenCellKey(p, t, ci);
+    if (lifetime <= 0.0f) { r |= 0x80000000; }
+    return r;
+}
 
-inline ivec3 Position2Index(mpWorld &w, const vec3 &pos)
+inline u32 mpGenHash(const mpKernelParams &p, const mpTempParams &t, const mpParticle &particle)
 {
-    const mpKernelParams &p = w.getKernelParams();
-    mpTempParams &t = w.getTempParams();
-    vec3 &bl = (vec3&)t.world_bounds_bl;
-    vec3 &rcpCell = (vec3&)t.rcp_cell_size;
-    int xb = clamp<i32>(i32((pos.x - bl.x)*rcpCell.x), 0, p.world_div.x - 1);
-    int zb = clamp<i32>(i32((pos.z - bl.z)*rcpCell.z), 0, p.world_div.z - 1);
-    int yb = clamp<i32>(i32((pos.y - bl.y)*rcpCell.y), 0, p.world_div.y - 1);
-    return ivec3(xb, yb, zb);
+    return mpGenHash(p, t, (vec3&)particle.position, particle.lifetime);
 }
 
-inline bool testSphere_AABB(const vec3 &sphere_pos, float sphere_radius, vec3 aabb_bl, vec3 &aabb_ur)
+// compact hash to radix sort key: cell bits + dead flag just above them.
+// key order is identical to hash order.
+inline u32 mpGenSortKey(u32 hash, int cell_bits)
 {
-    aabb_bl -= sphere_radius;
-    aabb_ur += sphere_radius;
-    return
-        sphere_pos.x > aabb_bl.x && sphere_pos.x < aabb_ur.x &&
-        sphere_pos.y > aabb_bl.y && sphere_pos.y < aabb_ur.y &&
-        sphere_pos.z > aabb_bl.z && sphere_pos.z < aabb_ur.z;
+    u32 cell_mask = (1 << cell_bits) - 1;
+    return (hash & cell_mask) | ((hash >> 31) << cell_bits);
 }
 
-inline bool testSphere_Sphere(const vec3 &sphere1_pos, float sphere1_radius, const vec3 &sphere2_pos, float sphere2_radius)
+inline void mpGenIndex(mpWorld &world, u32 hash, ispc::vec3i &idx)
 {
-    float r = sphere1_radius + sphere2_radius;
-    return glm::length_sq(sphere2_pos - sphere1_pos) < r*r;
+    mpTempParams &t = world.getTempParams();
+    u32 c = t.cell_key_decode[0][hash & 1023] | t.cell_key_decode[1][(hash >> 10) & 1023] | t.cell_key_decode[2][(hash >> 20) & 1023];
+    idx.x = c & 1023;
+    idx.y = (c >> 10) & 1023;
+    idx.z = (c >> 20) & 1023;
 }
 
-// 0: not overlapped, 1: overlapped, 2: completely inside
-inline int overlapAABB_AABB(const vec3 &aabb1_bl, const vec3 &aabb1_ur, const vec3 &aabb2_bl, const vec3 &aabb2_ur)
+typedef void(*mpCellKernel)(mpKernelContext &ctx, const ispc::vec3i &idx);
+
+// fused per-cell kernel (ProcessCell_* in mpCore.ispc) for the combination of features. null if there is nothing to do.
+inline mpCellKernel mpSelectCellKernel(bool forces, bool colliders, bool integrate, bool scale)
 {
-    if (aabb1_ur.x < aabb2_bl.x || aabb1_bl.x > aabb2_ur.x ||
-        aabb1_ur.y < aabb2_bl.y || aabb1_bl.y > aabb2_ur.y ||
-        aabb1_ur.z < aabb2_bl.z || aabb1_bl.z > aabb2_ur.z)
-    {
-        return 0;
-    }
-    else if (
-        aabb1_ur.x < aabb2_ur.x && aabb1_bl.x > aabb2_bl.x &&
-        aabb1_ur.y < aabb2_ur.y && aabb1_bl.y > aabb2_bl.y &&
-        aabb1_ur.z < aabb2_ur.z && aabb1_bl.z > aabb2_bl.z)
-    {
-        return 2;
-    }
-    else if (
-        aabb2_ur.x < aabb1_ur.x && aabb2_bl.x > aabb1_bl.x &&
-        aabb2_ur.y < aabb1_ur.y && aabb2_bl.y > aabb1_bl.y &&
-        aabb2_ur.z < aabb1_ur.z && aabb2_bl.z > aabb1_bl.z)
-    {
-        return 2;
-    }
-    return 1;
+    static const mpCellKernel s_kernels[] = {
+        nullptr,            ispc::ProcessCell_F,    ispc::ProcessCell_C,    ispc::ProcessCell_FC,
+        ispc::ProcessCell_I,  ispc::ProcessCell_FI,  ispc::ProcessCell_CI,  ispc::ProcessCell_FCI,
+        ispc::ProcessCell_IS, ispc::ProcessCell_FIS, ispc::ProcessCell_CIS, ispc::ProcessCell_FCIS,
+    };
+    return s_kernels[(forces ? 1 : 0) | (colliders ? 2 : 0) | (integrate ? (scale ? 8 : 4) : 0)];
 }
 
+typedef void(*mpImpulseCellKernel)(mpKernelContext &ctx, const ispc::vec3i &idx, bool by_particle);
 
-// 0: not overlapped, 1: overlapped, 2: completely inside
-inline int overlapSphere_AABB(const vec3 &sphere_pos, float sphere_radius, const vec3 &aabb_bl, const vec3 &aabb_ur)
+// fused impulse update (ImpulseCell_* in mpCore.ispc) for the combination of features
+inline mpImpulseCellKernel mpSelectImpulseCellKernel(bool forces, bool colliders, bool scale)
 {
-    int r = overlapAABB_AABB(sphere_pos - sphere_radius, sphere_pos + sphere_radius, aabb_bl, aabb_ur);
-    if (r == 2) {
-        float r2 = sphere_radius*sphere_radius;
-        if (glm::length_sq(aabb_bl - sphere_pos) > r2 || glm::length_sq(aabb_ur - sphere_pos) > r2) {
+    static const mpImpulseCellKernel s_kernels[] = {
+        ispc::ImpulseCell_I,  ispc::ImpulseCell_FI,  ispc::ImpulseCell_CI,  ispc::ImpulseCell_FCI,
+        ispc::ImpulseCell_IS, ispc::ImpulseCell_FIS, ispc::ImpulseCell_CIS, ispc::ImpulseCell_FCIS,
+    };
+    return s_kernels[(forces ? 1 : 0) | (colliders ? 2 : 0) | (scale ? 4 : 0)];
+}
+
+
+
+static const int g_particles_par_task = 2048;
+static const int g_lines_par_task = 16;
+static const int g_colored_cells_par_task = 32;
+// per-cell passes are split into this many tasks for each thread, by estimated work of cells
+static const int g_cell_tasks_par_thread = 8;
+static const int g_min_particles_par_cell_task = 128;
+// cost of work of a particle that doesn't depend on neighbors (forces, colliders, integration), in pairs
+static const float g_cell_weight_bias = 16.0f;
+// candidates of grain tuning. index 2 is the default above.
+static const int g_particles_par_task_candidates[] = { 512, 1024, 2048, 4096, 8192 };
+static const int g_cell_tasks_par_thread_candidates[] = { 2, 4, 8, 16, 32 };
+// incremental sort falls back to full sort if more than this ratio of particles changed cell
+static const float g_incremental_sort_max_moved = 0.2f;
+
+mpWorld::mpWorld()
+    : m_id_seed(0)
+    , m_num_particles(0)
+    , m_num_sorted(0)
+    , m_num_soa(0)
+    , m_aos_valid(true)
+    , m_num_cells(0)
+    , m_sparse_cells(false)
+    , m_soa_row_spans(false)
+    , m_soa_block_size(8)
+    , m_graph_phases(0)
+    , m_has_hithandler(false)
+    , m_has_forcehandler(false)
+    , m_timings()
+    , m_particles_par_task(g_particles_par_task)
+    , m_cell_tasks_par_thread(g_cell_tasks_par_thread)
+    , m_particles_tuner(g_particles_par_task_candidates, mpCountof(g_particles_par_task_candidates), 2)
+    , m_cells_tuner(g_cell_tasks_par_thread_candidates, mpCountof(g_cell_tasks_par_thread_candidates), 2)
+    , m_num_particles_gpu_prev(0)
+    , m_data_texture(nullptr)
+    , m_data_texture_layout(0)
+    , m_in_flight(false)
+    , m_front_valid(false)
+    , m_aos_owner(nullptr)
+{
+}
+
+mpWorld::~mpWorld()
+{
+    endUpdate();
+}
+
+const mpKernelParams& mpWorld::getKernelParams() const  { return m_in_flight ? m_requested_kparams : m_kparams; }
+
+void mpWorld::setKernelParams(const mpKernelParams &v)
+{
+    if (m_in_flight) {
+        m_requested_kparams = v;
+        m_deferred.push_back([this, v]() { setKernelParams(v); });
+        return;
+    }
+    if (memcmp(&m_kparams, &v, sizeof(v)) != 0) { m_front_valid = false; }
+    m_kparams = v;
+    m_kparams.data_texture_layout = std::min<int>(std::max<int>(m_kparams.data_texture_layout, 0), (int)mpDataTextureLayout::PositionHalf);
+
+    if (m_kparams.max_particles != (int)m_particles.size()) {
+        validateAoS();
+        m_num_soa = 0;
+
+        mpParticle blank;
+        blank.lifetime = 0.0f;
+
+        m_particles.resize(m_kparams.max_particles, blank);
+        m_num_particles = std::min<int>(m_num_particles, (int)m_kparams.max_particles);
+        m_nlists.valid = false;
+    }
+}
+
+mpTempParams& mpWorld::getTempParams()  { return m_tparams; }
+const mpCellCont& mpWorld::getCells()   { return m_cells; }
+const mpPhaseTimings& mpWorld::getPhaseTimings() const { return m_in_flight ? m_front.timings : m_timings; }
+
+int mpWorld::findCell(const ivec3 &ci) const
+{
+    u32 key = mpGenCellKey(m_kparams, m_tparams, ci);
+    if (!m_kparams.enable_sparse_grid) { return key; }
+
+    if (m_cell_table_keys.empty()) { return -1; }
+    u32 mask = (u32)m_cell_table_keys.size() - 1;
+    for (u32 h = mpCellKeyHash(key) & mask; ; h = (h + 1) & mask) {
+        u32 k = m_cell_table_keys[h];
+        if (k == key) { return m_cell_table_values[h]; }
+        if (k == 0xffffffff) { return -1; }
+    }
+}
+
+void mpWorld::forceSetNumParticles(int v)
+{
+    if (m_in_flight) {
+        m_deferred.push_back([this, v]() { forceSetNumParticles(v); });
+        return;
+    }
+    m_front_valid = false;
+    reclaimAoS();
+    v = std::min<int>(v, (int)m_kparams.max_particles);
+
+    // slots past the particle count are not kept by update(). the gather swaps in a buffer whose tail
+    // holds particles of older frames, so grown slots are made dead as well as dropped ones.
+    for (int i = std::min<int>(v, m_num_particles); i < std::max<int>(v, m_num_particles); ++i) {
+        m_particles[i].lifetime = 0.0f;
+    }
+
+    m_num_particles = std::min<int>(v, (int)m_kparams.max_particles);
+    m_num_soa = std::min<int>(m_num_soa, m_num_particles);
+    m_nlists.valid = false;
+}
+
+int         mpWorld::getNumParticles() const { return m_in_flight ? m_front.num_particles : m_num_particles; }
+int         mpWorld::getNumParticlesGPU() const { return m_snapshots.front().num_particles; }
+
+mpParticle* mpWorld::getParticlesGPU()
+{
+    const mpRenderSnapshot &snap = m_snapshots.front();
+    if (snap.layout != (int)mpDataTextureLayout::Full) { return nullptr; }
+    return (mpParticle*)snap.data.data();
+}
+
+mpParticle* mpWorld::getParticles()
+{
+    // while update is in flight, particles are read only.
+    if (m_in_flight) { return m_front.particles.data(); }
+    // caller may modify particles. AoS becomes the master data until next update.
+    validateAoS();
+    m_num_soa = 0;
+    m_front_valid = false;
+    return m_particles.data();
+}
+
+const mpParticle* mpWorld::getParticlesReadOnly()
+{
+    if (m_in_flight || m_aos_owner == &m_front) { return m_front.particles.data(); }
+    // SoA data stays the master data. AoS view is kept until next update.
+    validateAoS();
+    return m_particles.data();
+}
+
+mpParticleIM& mpWorld::getIntermediateData(int i)
+{
+    if (m_in_flight) { return m_front.imd[i]; }
+    validateAoS();
+    return m_imd[i];
+}
+
+mpParticleIM& mpWorld::getIntermediateData()
+{
+    return getIntermediateData(m_current);
+}
+
+template<class Body>
+inline void mpWorld::eachOccupiedCell(const Body &body)
+{
+    int num_tasks = (int)m_cell_task_offsets.size() - 1;
+    if (num_tasks <= 0) { return; }
+    ist::parallel_for(0, num_tasks, 1,
+        [&](int ti) {
+            int end = m_cell_task_offsets[ti + 1];
+            for (int i = m_cell_task_offsets[ti]; i < end; ++i) {
+                body(m_occupied_cells[i]);
+            }
+        });
+}
+
+template<class Body>
+inline void mpWorld::eachSoASpan(const Body &body)
+{
+    if (!m_soa_row_spans) {
+        eachOccupiedCell([&](int i) { body(m_cells[i]); });
+    }
+    else {
+        ist::parallel_for(0, (int)m_soa_lines.size(), g_lines_par_task,
+            [&](int i) { body(m_soa_lines[i]); });
+    }
+}
+
+template<class Body>
+inline void mpWorld::eachColoredCell(const Body &body)
+{
+    int num_colors = (int)m_color_offsets.size() - 1;
+    for (int c = 0; c < num_colors; ++c) {
+        ist::parallel_for(m_color_offsets[c], m_color_offsets[c + 1], g_colored_cells_par_task,
+            [&](int i) { body(m_colored_cells[i]); });
+    }
+}
+
+template<class Body>
+inline void mpWorld::eachOccupiedCellPhased(int num_phases, const Body &body)
+{
+    int num_tiles = (int)m_cell_task_offsets.size() - 1;
+    if (num_tiles <= 0) { return; }
+
+    // a graph gains nothing on one thread. run phases one by one.
+    if (!m_kparams.enable_task_graph || ist::local_max_concurrency() == 1 || !buildTileGraph(num_phases)) {
+        for (int p = 0; p < num_phases; ++p) {
+            eachOccupiedCell([&](int i) { body(p, i); });
+        }
+        return;
+    }
+    ist::parallel_graph(num_phases * num_tiles, m_graph_preds.data(), m_graph_succ_offsets.data(), m_graph_succs.data(),
+        [&](int node) {
+            int p = node / num_tiles;
+            int ti = node % num_tiles;
+            int end = m_cell_task_offsets[ti + 1];
+            for (int i = m_cell_task_offsets[ti]; i < end; ++i) {
+                body(p, m_occupied_cells[i]);
+            }
+        });
+}
+
+bool mpWorld::buildTileGraph(int num_phases)
+{
+    // on Linear ordering, neighbors of a cell are in y-1..y+1 layers, which are a contiguous range of keys.
+    // so tiles around a tile are the ones that have cells in key range of its first cell's y-1 to its last cell's y+1.
+    // sparse grid wraps around y. tiles on first or last layer wait for all tiles.
+    if ((mpCellOrdering)m_kparams.cell_ordering != mpCellOrdering::Linear) { return false; }
+
+    int num_tiles = (int)m_cell_task_offsets.size() - 1;
+    int num_cells = m_num_cells;
+    int shift_y = m_tparams.world_div_bits.x + m_tparams.world_div_bits.z;
+    int last_y = m_kparams.world_div.y - 1;
+    bool sparse_grid = m_kparams.enable_sparse_grid != 0;
+    const int *offsets = m_cell_task_offsets.data();
+    auto cell_key = [&](int i) { return m_sort_keys[m_cells[m_occupied_cells[i]].begin]; };
+    auto first_cell_at = [&](u32 key) {
+        int lo = 0, hi = num_cells;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cell_key(mid) < key) { lo = mid + 1; }
+            else { hi = mid; }
+        }
+        return lo;
+    };
+    auto tile_of = [&](int i) { return int(std::upper_bound(offsets, offsets + num_tiles + 1, i) - offsets) - 1; };
+
+    m_tile_ranges_tmp.resize(num_tiles * 2);
+    ist::parallel_for(0, num_tiles,
+        [&](int ti) {
+            int beg = offsets[ti];
+            int end = offsets[ti + 1];
+            int lo = ti, hi = ti;
+            if (beg < end) {
+                int y_first = int(cell_key(beg) >> shift_y);
+                int y_last = int(cell_key(end - 1) >> shift_y);
+                if (sparse_grid && (y_first == 0 || y_last >= last_y)) {
+                    lo = 0;
+                    hi = num_tiles - 1;
+                }
+                else {
+                    lo = tile_of(first_cell_at(y_first > 0 ? u32(y_first - 1) << shift_y : 0));
+                    hi = tile_of(first_cell_at(u32(y_last + 2) << shift_y) - 1);
+                }
+            }
+            m_tile_ranges_tmp[ti * 2 + 0] = lo;
+            m_tile_ranges_tmp[ti * 2 + 1] = hi;
+        });
+
+    // graph is made of ranges only. it usually lasts while tiles stay on the same layers.
+    if (num_phases == m_graph_phases && m_tile_ranges_tmp == m_tile_ranges) { return true; }
+    m_tile_ranges.swap(m_tile_ranges_tmp);
+    m_graph_phases = num_phases;
+
+    // node of phase p, tile t is p * num_tiles + t. successors of phase p nodes are in phase p+1.
+    int num_nodes = num_phases * num_tiles;
+    m_graph_preds.resize(num_nodes);
+    m_graph_succ_offsets.resize(num_nodes + 1);
+    std::fill(m_graph_succ_offsets.begin(), m_graph_succ_offsets.end(), 0);
+    for (int ti = 0; ti < num_tiles; ++ti) {
+        int lo = m_tile_ranges[ti * 2 + 0];
+        int hi = m_tile_ranges[ti * 2 + 1];
+        for (int p = 0; p < num_phases; ++p) {
+            m_graph_preds[p * num_tiles + ti] = p == 0 ? 0 : hi - lo + 1;
+        }
+        for (int t = lo; t <= hi; ++t) {
+            for (int p = 0; p + 1 < num_phases; ++p) {
+                ++m_graph_succ_offsets[p * num_tiles + t];
+            }
+        }
+    }
+    int num_edges = ist::parallel_scan(m_graph_succ_offsets.data(), num_nodes);
+    m_graph_succ_offsets[num_nodes] = num_edges;
+    m_graph_succs.resize(num_edges);
+    for (int ti = 0; ti < num_tiles; ++ti) {
+        int lo = m_tile_ranges[ti * 2 + 0];
+        int hi = m_tile_ranges[ti * 2 + 1];
+        for (int t = lo; t <= hi; ++t) {
+            for (int p = 0; p + 1 < num_phases; ++p) {
+                // offsets are advanced while filling, and restored below
+                m_graph_succs[m_graph_succ_offsets[p * num_tiles + t]++] = (p + 1) * num_tiles + ti;
+            }
+        }
+    }
+    for (int i = num_nodes; i > 0; --i) {
+        m_graph_succ_offsets[i] = m_graph_succ_offsets[i - 1];
+    }
+    m_graph_succ_offsets[0] = 0;
+    return true;
+}
+
+void mpWorld::validateAoS()
+{
+    reclaimAoS();
+    if (m_aos_valid) { return; }
+    m_aos_valid = true;
+    if (m_num_soa == 0) { return; }
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+
+    eachSoASpan(
+        [&](const mpCell &span) {
+            mpAoSnizeFull(span, m_soa, m_particles.data(), m_imd.data());
+        });
+}
+
+void mpWorld::reclaimAoS()
+{
+    if (!m_aos_owner) { return; }
+    m_particles.swap(m_aos_owner->particles);
+    m_imd.swap(m_aos_owner->imd);
+    m_aos_owner = nullptr;
+    m_front_valid = false;
+}
+
+void mpWorld::writeBackParticle(int i)
+{
+    if (i >= m_num_soa) { return; }
+    const mpParticle &p = m_particles[i];
+    const mpParticleIM &im = m_imd[i];
+    const vec4 &pos = (vec4&)p.position;
+    const vec4 &vel = (vec4&)p.velocity;
+    const vec4 &acl = (vec4&)im.accel;
+    int si = m_soa_slots[i];
+    m_soa.pos_x[si] = pos.x;
+    m_soa.pos_y[si] = pos.y;
+    m_soa.pos_z[si] = pos.z;
+    m_soa.vel_x[si] = vel.x;
+    m_soa.vel_y[si] = vel.y;
+    m_soa.vel_z[si] = vel.z;
+    m_soa.speed[si] = vel.w;
+    m_soa.acl_x[si] = acl.x;
+    m_soa.acl_y[si] = acl.y;
+    m_soa.acl_z[si] = acl.z;
+    m_soa.density[si] = p.density;
+    m_soa.lifetime[si] = p.lifetime;
+    m_soa.id[si] = p.id;
+    m_soa.userdata[si] = p.userdata;
+    m_soa.hit[si] = p.hit;
+    m_soa.hit_prev[si] = p.hit_prev;
+}
+
+std::mutex& mpWorld::getMutex() { return m_mutex; }
+
+
+void mpWorld::addParticles(mpParticle *p, size_t num)
+{
+    if (m_in_flight) {
+        mpParticleCont tmp(p, p + num);
+        m_deferred.push_back([this, tmp]() mutable { addParticles(tmp.data(), tmp.size()); });
+        return;
+    }
+    if (num > 0) {
+        m_front_valid = false;
+        reclaimAoS();
+    }
+    num = std::min<size_t>(num, m_kparams.max_particles - m_num_particles);
+    for (int i = 0; i < (int)num; ++i) {
+        m_particles[m_num_particles + i] = p[i];
+    }
+    if (m_kparams.id_as_float) {
+        for (int i = 0; i < (int)num; ++i) {
+            (float&)m_particles[m_num_particles + i].id = float(++m_id_seed);
+        }
+    }
+    else {
+        for (int i = 0; i < (int)num; ++i) {
+            m_particles[m_num_particles + i].id = ++m_id_seed;
+        }
+    }
+    m_num_particles += (int)num;
+    if (num > 0) {
+        // new particles have no neighbor lists
+        m_nlists.valid = false;
+    }
+}
+
+void mpWorld::addPlaneColliders(mpPlaneCollider *col, size_t num)
+{
+    if (m_in_flight) {
+        mpPlaneColliderCont tmp(col, col + num);
+        m_deferred.push_back([this, tmp]() mutable { addPlaneColliders(tmp.data(), tmp.size()); });
+        return;
+    }
+    m_plane_colliders.insert(m_plane_colliders.end(), col, col + num);
+}
+
+void mpWorld::addSphereColliders(mpSphereCollider *col, size_t num)
+{
+    if (m_in_flight) {
+        mpSphereColliderCont tmp(col, col + num);
+        m_deferred.push_back([this, tmp]() mutable { addSphereColliders(tmp.data(), tmp.size()); });
+        return;
+    }
+    m_sphere_colliders.insert(m_sphere_colliders.end(), col, col + num);
+}
+
+void mpWorld::addCapsuleColliders(mpCapsuleCollider *col, size_t num)
+{
+    if (m_in_flight) {
+        mpCapsuleColliderCont tmp(col, col + num);
+        m_deferred.push_back([this, tmp]() mutable { addCapsuleColliders(tmp.data(), tmp.size()); });
+        return;
+    }
+    m_capsule_colliders.insert(m_capsule_colliders.end(), col, col + num);
+}
+
+void mpWorld::addBoxColliders(mpBoxCollider *col, size_t num)
+{
+    if (m_in_flight) {
+        mpBoxColliderCont tmp(col, col + num);
+        m_deferred.push_back([this, tmp]() mutable { addBoxColliders(tmp.data(), tmp.size()); });
+        return;
+    }
+    m_box_colliders.insert(m_box_colliders.end(), col, col + num);
+}
+
+
+// clear handlers of collider of owner_id. returns false if colliders doesn't have it.
+template<class Colliders>
+inline bool mpClearHandlers(Colliders &colliders, int owner_id)
+{
+    auto i = std::lower_bound(colliders.begin(), colliders.end(), owner_id,
+        [&](const typename Colliders::value_type &c, int i) { return c.props.owner_id < i; });
+    if (i != colliders.end()) {
+        i->props.hit_handler = nullptr;
+        i->props.force_handler = nullptr;
+        return true;
+    }
+    return false;
+}
+
+void mpWorld::removeCollider(mpColliderProperties &props)
+{
+    int id = props.owner_id;
+    if (m_in_flight) {
+        // owner may be gone before endUpdate(). readers must not call its handlers from now on.
+        mpClearHandlers(m_front.box_colliders, id) ||
+        mpClearHandlers(m_front.sphere_colliders, id) ||
+        mpClearHandlers(m_front.capsule_colliders, id) ||
+        mpClearHandlers(m_front.plane_colliders, id);
+        mpColliderProperties tmp = props;
+        m_deferred.push_back([this, tmp]() mutable { removeCollider(tmp); });
+        return;
+    }
+    mpClearHandlers(m_box_colliders, id) ||
+    mpClearHandlers(m_sphere_colliders, id) ||
+    mpClearHandlers(m_capsule_colliders, id) ||
+    mpClearHandlers(m_plane_colliders, id);
+}
+
+
+void mpWorld::addForces(mpForce *force, size_t num)
+{
+    if (m_in_flight) {
+        mpForceCont tmp(force, force + num);
+        m_deferred.push_back([this, tmp]() mutable { addForces(tmp.data(), tmp.size()); });
+        return;
+    }
+    m_forces.insert(m_forces.end(), force, force + num);
+}
+
+
+inline ivec3 Position2Index(const mpKernelParams &p, const mpTempParams &t, const vec3 &pos)
+{
+    const vec3 &bl = (const vec3&)t.world_bounds_bl;
+    const vec3 &rcpCell = (const vec3&)t.rcp_cell_size;
+    if (p.enable_sparse_grid) {
+        return mpGenCellCoord(t, pos);
+    }
+    int xb = clamp<i32>(i32((pos.x - bl.x)*rcpCell.x), 0, p.world_div.x - 1);
+    int zb = clamp<i32>(i32((pos.z - bl.z)*rcpCell.z), 0, p.world_div.z - 1);
+    int yb = clamp<i32>(i32((pos.y - bl.y)*rcpCell.y), 0, p.world_div.y - 1);
+    return ivec3(xb, yb, zb);
+}
+
+inline bool testSphere_AABB(const vec3 &sphere_pos, float sphere_radius, vec3 aabb_bl, vec3 &aabb_ur)
+{
+    aabb_bl -= sphere_radius;
+    aabb_ur += sphere_radius;
+    return
+        sphere_pos.x > aabb_bl.x && sphere_pos.x < aabb_ur.x &&
+        sphere_pos.y > aabb_bl.y && sphere_pos.y < aabb_ur.y &&
+        sphere_pos.z > aabb_bl.z && sphere_pos.z < aabb_ur.z;
+}
+
+inline bool testSphere_Sphere(const vec3 &sphere1_pos, float sphere1_radius, const vec3 &sphere2_pos, float sphere2_radius)
+{
+    float r = sphere1_radius + sphere2_radius;
+    return glm::length_sq(sphere2_pos - sphere1_pos) < r*r;
+}
+
+// 0: not overlapped, 1: overlapped, 2: completely inside
+inline int overlapAABB_AABB(const vec3 &aabb1_bl, const vec3 &aabb1_ur, const vec3 &aabb2_bl, const vec3 &aabb2_ur)
+{
+    if (aabb1_ur.x < aabb2_bl.x || aabb1_bl.x > aabb2_ur.x ||
+        aabb1_ur.y < aabb2_bl.y || aabb1_bl.y > aabb2_ur.y ||
+        aabb1_ur.z < aabb2_bl.z || aabb1_bl.z > aabb2_ur.z)
+    {
+        return 0;
+    }
+    else if (
+        aabb1_ur.x < aabb2_ur.x && aabb1_bl.x > aabb2_bl.x &&
+        aabb1_ur.y < aabb2_ur.y && aabb1_bl.y > aabb2_bl.y &&
+        aabb1_ur.z < aabb2_ur.z && aabb1_bl.z > aabb2_bl.z)
+    {
+        return 2;
+    }
+    else if (
+        aabb2_ur.x < aabb1_ur.x && aabb2_bl.x > aabb1_bl.x &&
+        aabb2_ur.y < aabb1_ur.y && aabb2_bl.y > aabb1_bl.y &&
+        aabb2_ur.z < aabb1_ur.z && aabb2_bl.z > aabb1_bl.z)
+    {
+        return 2;
+    }
+    return 1;
+}
+
+
+// 0: not overlapped, 1: overlapped, 2: completely inside
+inline int overlapSphere_AABB(const vec3 &sphere_pos, float sphere_radius, const vec3 &aabb_bl, const vec3 &aabb_ur)
+{
+    int r = overlapAABB_AABB(sphere_pos - sphere_radius, sphere_pos + sphere_radius, aabb_bl, aabb_ur);
+    if (r == 2) {
+        float r2 = sphere_radius*sphere_radius;
+        if (glm::length_sq(aabb_bl - sphere_pos) > r2 || glm::length_sq(aabb_ur - sphere_pos) > r2) {
             r = 1;
         }
     }
@@ -389,40 +1198,33 @@ inline int overlapSphere_AABB(const vec3 &sphere_pos, float sphere_radius, const
 }
 
 
-// f: [](const mpCell &cell, const ivec3 &cell_index)
+// f: [](const ivec3 &cell_index)
+// range is limited to one period of world_div as sparse cells wrap around.
 template<class F>
-inline void ScanCells(mpWorld &w, const ivec3 &imin, const ivec3 &imax, const F &f)
+inline void ScanCells(const ivec3 &world_div, const ivec3 &imin, ivec3 imax, const F &f)
 {
-    const mpCellCont &cells = w.getCells();
-    if (cells.empty()) return;
-    ivec3 bits = w.getTempParams().world_div_bits;
-    mpParticle *particles = w.getParticles();
+    imax = glm::min(imax, imin + world_div);
     for (int iy = imin.y; iy < imax.y; ++iy) {
         for (int iz = imin.z; iz < imax.z; ++iz) {
             for (int ix = imin.x; ix < imax.x; ++ix) {
-                u32 ci = ix | (iz << bits.x) | (iy << (bits.x + bits.z));
-                f(cells[ci], ivec3(ix, iy, iz));
+                f(ivec3(ix, iy, iz));
             }
         }
     }
 }
 
-// f: [](const mpCell &cell, const ivec3 &cell_index)
+// f: [](const ivec3 &cell_index)
 template<class F>
-inline void ScanCellsParallel(mpWorld &w, const ivec3 &imin, const ivec3 &imax, const F &f)
+inline void ScanCellsParallel(const ivec3 &world_div, const ivec3 &imin, ivec3 imax, const F &f)
 {
-    const mpCellCont &cells = w.getCells();
-    if (cells.empty()) return;
-    ivec3 bits = w.getTempParams().world_div_bits;
-    mpParticle *particles = w.getParticles();
+    imax = glm::min(imax, imin + world_div);
     int lz = imax.z - imin.z;
     int ly = imax.y - imin.y;
     if (ly > 4) {
         ist::parallel_for(imin.y, imax.y, [&](int iy) {
             for (int iz = imin.z; iz < imax.z; ++iz) {
                 for (int ix = imin.x; ix < imax.x; ++ix) {
-                    u32 ci = ix | (iz << bits.x) | (iy << (bits.x + bits.z));
-                    f(cells[ci], ivec3(ix, iy, iz));
+                    f(ivec3(ix, iy, iz));
                 }
             }
         });
@@ -431,138 +1233,196 @@ inline void ScanCellsParallel(mpWorld &w, const ivec3 &imin, const ivec3 &imax,
         for (int iy = imin.y; iy < imax.y; ++iy) {
             ist::parallel_for(imin.z, imax.z, [&](int iz) {
                 for (int ix = imin.x; ix < imax.x; ++ix) {
-                    u32 ci = ix | (iz << bits.x) | (iy << (bits.x + bits.z));
-                    f(cells[ci], ivec3(ix, iy, iz));
+                    f(ivec3(ix, iy, iz));
                 }
             });
         }
     }
     else {
-        ScanCells(w, imin, imax, f);
+        ScanCells(world_div, imin, imax, f);
     }
 }
 
-void mpWorld::scanSphere(mpHitHandler handler, const vec3 &pos, float radius)
+template<class Overlap, class Test>
+inline void mpWorld::scanCells(bool parallel, mpHitHandler handler, const vec3 &bl, const vec3 &ur, const Overlap &overlap, const Test &test)
 {
-    const mpKernelParams &k = m_kparams;
-    const mpTempParams &t = m_tparams;
-    ivec3 imin = Position2Index(*this, pos - radius);
-    ivec3 imax = Position2Index(*this, pos + radius) + 1;
-    int r = 0;
-    ScanCells(*this, imin, imax, [&](const mpCell &cell, const ivec3 &ci) {
+    bool front = m_in_flight;
+    if (!front) {
+        validateAoS();
+        m_front_valid = false;
+    }
+    const mpKernelParams &k = front ? m_front.kparams : m_kparams;
+    const mpTempParams &t = front ? m_front.tparams : m_tparams;
+    const mpCellCont &cells = front ? m_front.cells : m_cells;
+    mpParticle *particles = front ? m_front.particles.data() : m_particles.data();
+    if (cells.empty()) { return; }
+
+    // m_front has occupied cells only. they are looked up by key.
+    const mpUIntArray &keys = m_front.cell_keys;
+    auto find_cell = [&](const ivec3 &ci) -> int {
+        if (!front) { return findCell(ci); }
+        u32 key = mpGenCellKey(k, t, ci);
+        auto i = std::lower_bound(keys.begin(), keys.end(), key);
+        return i != keys.end() && *i == key ? int(i - keys.begin()) : -1;
+    };
+
+    ivec3 imin = Position2Index(k, t, bl);
+    ivec3 imax = Position2Index(k, t, ur) + 1;
+    auto body = [&](const ivec3 &ci) {
+        int ic = find_cell(ci);
+        if (ic < 0) { return; }
+        const mpCell &cell = cells[ic];
         vec3 cell_bl = t.world_bounds_bl + (t.cell_size * vec3(ci));
         vec3 cell_ur = cell_bl + t.cell_size;
-        int o = overlapSphere_AABB(pos, radius, cell_bl, cell_ur);
-        if (o == 2) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                handler(&m_particles[i]);
+        int o = k.enable_sparse_grid ? 1 : overlap(cell_bl, cell_ur);
+        if (o == 0) { return; }
+        for (int i = cell.begin; i < cell.end; ++i) {
+            if (o == 2 || test((vec3&)particles[i].position, k.particle_size)) {
+                invokeHandler(handler, particles, i);
             }
         }
-        else if (o == 1) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                if (testSphere_Sphere((vec3&)m_particles[i].position, k.particle_size, pos, radius)) {
-                    handler(&m_particles[i]);
+    };
+    if (parallel) { ScanCellsParallel((const ivec3&)k.world_div, imin, imax, body); }
+    else          { ScanCells((const ivec3&)k.world_div, imin, imax, body); }
+
+    if (front) { flushEdits(); }
+}
+
+void mpWorld::invokeHandler(mpHitHandler handler, mpParticle *particles, int i)
+{
+    if (!m_in_flight) {
+        handler(&particles[i]);
+        writeBackParticle(i);
+        return;
+    }
+    // m_front is not changed. modified particles are recorded and applied to new state at endUpdate().
+    mpParticleEdit e;
+    e.base = particles[i];
+    e.edited = particles[i];
+    handler(&e.edited);
+    if (memcmp(&e.base, &e.edited, sizeof(mpParticle)) != 0) {
+        std::unique_lock<std::mutex> lock(m_edits_mutex);
+        m_edits.push_back(e);
+    }
+}
+
+void mpWorld::flushEdits()
+{
+    if (m_edits.empty()) { return; }
+    mpParticleEditCont edits;
+    edits.swap(m_edits);
+    m_deferred.push_back([this, edits]() mutable { applyEdits(edits); });
+}
+
+void mpWorld::applyEdits(mpParticleEditCont &edits)
+{
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+    m_front_valid = false;
+    // ids are unique. edits of a particle are applied in order they were recorded.
+    std::stable_sort(edits.begin(), edits.end(),
+        [](const mpParticleEdit &a, const mpParticleEdit &b) { return a.base.id < b.base.id; });
+    validateAoS();
+    ist::parallel_for(0, m_num_particles, m_particles_par_task,
+        [&](int i) {
+            u32 id = m_particles[i].id;
+            auto e = std::lower_bound(edits.begin(), edits.end(), id,
+                [](const mpParticleEdit &e, u32 id) { return e.base.id < id; });
+            if (e == edits.end() || e->base.id != id) { return; }
+
+            // update has moved the particle since. only words the handler changed are overwritten.
+            mpParticle &p = m_particles[i];
+            for (; e != edits.end() && e->base.id == id; ++e) {
+                const u32 *base = (const u32*)&e->base;
+                const u32 *edited = (const u32*)&e->edited;
+                u32 *dst = (u32*)&p;
+                for (int w = 0; w < (int)(sizeof(mpParticle) / sizeof(u32)); ++w) {
+                    if (edited[w] != base[w]) { dst[w] = edited[w]; }
                 }
             }
-        }
-    });
+            writeBackParticle(i);
+        });
+}
+
+void mpWorld::scanSphere(mpHitHandler handler, const vec3 &pos, float radius)
+{
+    scanCells(false, handler, pos - radius, pos + radius,
+        [&](const vec3 &cell_bl, const vec3 &cell_ur) { return overlapSphere_AABB(pos, radius, cell_bl, cell_ur); },
+        [&](const vec3 &ppos, float psize) { return testSphere_Sphere(ppos, psize, pos, radius); });
 }
 
 void mpWorld::scanAABB(mpHitHandler handler, const vec3 &center, const vec3 &extent)
 {
-    const mpKernelParams &k = m_kparams;
-    const mpTempParams &t = m_tparams;
-    ivec3 imin = Position2Index(*this, center - extent);
-    ivec3 imax = Position2Index(*this, center + extent) + 1;
-    ScanCells(*this, imin, imax, [&](const mpCell &cell, const ivec3 &ci) {
-        vec3 cell_bl = t.world_bounds_bl + (t.cell_size * vec3(ci));
-        vec3 cell_ur = cell_bl + t.cell_size;
-        int o = overlapAABB_AABB(center - extent, center + extent, cell_bl, cell_ur);
-        if (o == 2) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                handler(&m_particles[i]);
-            }
-        }
-        else if (o == 1) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                if (testSphere_AABB((vec3&)m_particles[i].position, k.particle_size, center - extent, center + extent)) {
-                    handler(&m_particles[i]);
-                }
-            }
-        }
-    });
+    scanCells(false, handler, center - extent, center + extent,
+        [&](const vec3 &cell_bl, const vec3 &cell_ur) { return overlapAABB_AABB(center - extent, center + extent, cell_bl, cell_ur); },
+        [&](const vec3 &ppos, float psize) { return testSphere_AABB(ppos, psize, center - extent, center + extent); });
 }
 
 void mpWorld::scanSphereParallel(mpHitHandler handler, const vec3 &pos, float radius)
 {
-    const mpKernelParams &k = m_kparams;
-    const mpTempParams &t = m_tparams;
-    ivec3 imin = Position2Index(*this, pos - radius);
-    ivec3 imax = Position2Index(*this, pos + radius) + 1;
-    int r = 0;
-    ScanCellsParallel(*this, imin, imax, [&](const mpCell &cell, const ivec3 &ci) {
-        vec3 cell_bl = t.world_bounds_bl + (t.cell_size * vec3(ci));
-        vec3 cell_ur = cell_bl + t.cell_size;
-        int o = overlapSphere_AABB(pos, radius, cell_bl, cell_ur);
-        if (o == 2) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                handler(&m_particles[i]);
-            }
-        }
-        else if (o == 1) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                if (testSphere_Sphere((vec3&)m_particles[i].position, k.particle_size, pos, radius)) {
-                    handler(&m_particles[i]);
-                }
-            }
-        }
-    });
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+    scanCells(true, handler, pos - radius, pos + radius,
+        [&](const vec3 &cell_bl, const vec3 &cell_ur) { return overlapSphere_AABB(pos, radius, cell_bl, cell_ur); },
+        [&](const vec3 &ppos, float psize) { return testSphere_Sphere(ppos, psize, pos, radius); });
 }
 
 void mpWorld::scanAABBParallel(mpHitHandler handler, const vec3 &center, const vec3 &extent)
 {
-    const mpKernelParams &k = m_kparams;
-    const mpTempParams &t = m_tparams;
-    ivec3 imin = Position2Index(*this, center - extent);
-    ivec3 imax = Position2Index(*this, center + extent) + 1;
-    ScanCellsParallel(*this, imin, imax, [&](const mpCell &cell, const ivec3 &ci) {
-        vec3 cell_bl = t.world_bounds_bl + (t.cell_size * vec3(ci));
-        vec3 cell_ur = cell_bl + t.cell_size;
-        int o = overlapAABB_AABB(center - extent, center + extent, cell_bl, cell_ur);
-        if (o == 2) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                handler(&m_particles[i]);
-            }
-        }
-        else if (o == 1) {
-            for (int i = cell.begin; i < cell.end; ++i) {
-                if (testSphere_AABB((vec3&)m_particles[i].position, k.particle_size, center - extent, center + extent)) {
-                    handler(&m_particles[i]);
-                }
-            }
-        }
-    });
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+    scanCells(true, handler, center - extent, center + extent,
+        [&](const vec3 &cell_bl, const vec3 &cell_ur) { return overlapAABB_AABB(center - extent, center + extent, cell_bl, cell_ur); },
+        [&](const vec3 &ppos, float psize) { return testSphere_AABB(ppos, psize, center - extent, center + extent); });
 }
 
 void mpWorld::scanAll(mpHitHandler handler)
 {
-    for (int i = 0; i < m_num_particles; ++i) {
-        handler(&m_particles[i]);
+    bool front = m_in_flight;
+    if (!front) {
+        validateAoS();
+        m_front_valid = false;
     }
+    mpParticle *particles = front ? m_front.particles.data() : m_particles.data();
+    int num = front ? m_front.num_particles : m_num_particles;
+    for (int i = 0; i < num; ++i) {
+        invokeHandler(handler, particles, i);
+    }
+    if (front) { flushEdits(); }
 }
 
 void mpWorld::scanAllParallel(mpHitHandler handler)
 {
-    ist::parallel_for(0, m_num_particles, g_particles_par_task,
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+    bool front = m_in_flight;
+    if (!front) {
+        validateAoS();
+        m_front_valid = false;
+    }
+    mpParticle *particles = front ? m_front.particles.data() : m_particles.data();
+    int num = front ? m_front.num_particles : m_num_particles;
+    // m_particles_par_task is tuned by update in flight
+    ist::parallel_for(0, num, front ? g_particles_par_task : m_particles_par_task,
         [&](int i) {
-            handler(&m_particles[i]);
+            invokeHandler(handler, particles, i);
         });
+    if (front) { flushEdits(); }
 }
 
 void mpWorld::moveAll(const vec3 &move)
 {
-    ist::parallel_for(0, m_num_particles, g_particles_par_task,
+    if (m_in_flight) {
+        m_deferred.push_back([this, move]() { moveAll(move); });
+        return;
+    }
+    m_front_valid = false;
+    reclaimAoS();
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+    ist::parallel_for(0, m_num_particles, m_particles_par_task,
         [&](int i) {
+            if (i < m_num_soa) {
+                int si = m_soa_slots[i];
+                m_soa.pos_x[si] += move.x;
+                m_soa.pos_y[si] += move.y;
+                m_soa.pos_z[si] += move.z;
+            }
             (vec3&)m_particles[i].position += move;
         });
 }
@@ -570,7 +1430,15 @@ void mpWorld::moveAll(const vec3 &move)
 
 void mpWorld::clearParticles()
 {
+    if (m_in_flight) {
+        m_deferred.push_back([this]() { clearParticles(); });
+        return;
+    }
+    m_front_valid = false;
+    reclaimAoS();
     m_num_particles = 0;
+    m_num_soa = 0;
+    m_nlists.valid = false;
     for (u32 i = 0; i < m_particles.size(); ++i) {
         m_particles[i].lifetime = 0.0f;
     }
@@ -578,6 +1446,10 @@ void mpWorld::clearParticles()
 
 void mpWorld::clearCollidersAndForces()
 {
+    if (m_in_flight) {
+        m_deferred.push_back([this]() { clearCollidersAndForces(); });
+        return;
+    }
     m_plane_colliders.clear();
     m_sphere_colliders.clear();
     m_capsule_colliders.clear();
@@ -591,11 +1463,33 @@ void mpWorld::clearCollidersAndForces()
 
 void mpWorld::update(float dt)
 {
+    m_front_valid = false;
+    m_timings = mpPhaseTimings();
+    // particles handed to a generation by publishGeneration() are copied back by the hash pass.
+    // readers may be using that generation, so it can't be taken back by swap.
+    const mpGeneration *aos_owner = m_aos_owner;
+    m_aos_owner = nullptr;
     if (m_num_particles == 0) { return; }
+    // cap number of threads working for this world, so a background world can't starve others
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+
+    // wall time of phases for profiling tools
+    auto time_begin = std::chrono::high_resolution_clock::now();
+    auto time_phase = time_begin;
+    auto end_phase = [&](float &dst) {
+        auto now = std::chrono::high_resolution_clock::now();
+        dst = std::chrono::duration<float, std::milli>(now - time_phase).count();
+        time_phase = now;
+    };
 
     mpKernelParams &kp = m_kparams;
     mpTempParams &tp = m_tparams;
     int cell_num = 0;
+    int soa_block_size = 8;
+    bool cells_reallocated = false;
+    bool tune_grain = kp.enable_grain_tuning != 0;
+    m_particles_par_task = tune_grain ? m_particles_tuner.get() : g_particles_par_task;
+    m_cell_tasks_par_thread = tune_grain ? m_cells_tuner.get() : g_cell_tasks_par_thread;
 
     {
         vec3 &wpos = (vec3&)kp.world_center;
@@ -607,12 +1501,13 @@ void mpWorld::update(float dt)
         kp.particle_size = std::max<float>(kp.particle_size, 0.00001f);
         kp.max_particles = std::max<int>(kp.max_particles, 128);
         m_num_particles = std::min<int>(m_num_particles, kp.max_particles);
-        kp.world_div.x = clamp<int>(1 << msb(kp.world_div.x), 1, 1024);
-        kp.world_div.y = clamp<int>(1 << msb(kp.world_div.y), 1, 1024);
-        kp.world_div.z = clamp<int>(1 << msb(kp.world_div.z), 1, 1024);
+        kp.world_div.x = clamp<int>(1 << msb(kp.world_div.x), 1, mpMaxWorldDiv);
+        kp.world_div.y = clamp<int>(1 << msb(kp.world_div.y), 1, mpMaxWorldDiv);
+        kp.world_div.z = clamp<int>(1 << msb(kp.world_div.z), 1, mpMaxWorldDiv);
         tp.world_div_bits.x = msb(kp.world_div.x);
         tp.world_div_bits.y = msb(kp.world_div.y);
         tp.world_div_bits.z = msb(kp.world_div.z);
+        mpGenCellKeyTables(kp, tp);
         cell_num = kp.world_div.x * kp.world_div.y * kp.world_div.z;
         cellsize = (wsize*2.0f / vec3((float)kp.world_div.x, (float)kp.world_div.y, (float)kp.world_div.z));
         cellsize_r = vec3(1.0f, 1.0f, 1.0f) / cellsize;
@@ -626,18 +1521,58 @@ void mpWorld::update(float dt)
             asize = wsize;
         }
 
-        int reserve_size = mpParticlesEachLine * (ceildiv(kp.max_particles, mpParticlesEachLine));
-        m_cells.resize(cell_num);
-        m_particles.resize(kp.max_particles);
-        m_imd.resize(kp.max_particles);
-        m_particles_gpu.reserve(reserve_size);
-        m_particles_gpu.resize(kp.max_particles);
-
+        // 16 lets 16 wide kernels (AVX-512) start each cell at a cache line
+        soa_block_size = kp.soa_block_size != 0 ? kp.soa_block_size : ispc::GetProgramCount();
+        soa_block_size = soa_block_size >= 16 ? 16 : 8;
         int num_soa_data_blocks = std::min<int>(cell_num, kp.max_particles);
         if (kp.max_particles > cell_num) {
-            num_soa_data_blocks = cell_num + ((kp.max_particles - cell_num + 1) / 8);
+            num_soa_data_blocks = cell_num + ((kp.max_particles - cell_num + 1) / soa_block_size);
+        }
+        size_t soa_capacity = size_t(num_soa_data_blocks) * soa_block_size;
+        if (!kp.enable_persistent_soa || m_soa.pos_x.size() != soa_capacity) {
+            // SoA data is no longer the master data or is about to be reallocated
+            validateAoS();
+            m_num_soa = 0;
+        }
+
+        if (!kp.enable_sparse_grid) {
+            if ((int)m_cells.size() != cell_num || m_sparse_cells) {
+                // occupied cells of last frame are meaningless. start from cleared grid.
+                m_cells.clear();
+                m_cells.resize(cell_num);
+                cells_reallocated = true;
+            }
+        }
+        else {
+            // occupied cells never exceed number of particles
+            m_cells.resize(std::min<int>(cell_num, kp.max_particles));
+            m_cell_coords.resize(m_cells.size());
+        }
+        m_sparse_cells = kp.enable_sparse_grid != 0;
+        m_particles.resize(kp.max_particles);
+        m_imd.resize(kp.max_particles);
+        m_particles_tmp.resize(kp.max_particles);
+        m_imd_tmp.resize(kp.max_particles);
+        m_sort_keys.resize(kp.max_particles);
+        m_sort_keys_tmp.resize(kp.max_particles);
+        m_sort_keys_prev.resize(kp.max_particles);
+        m_sort_indices.resize(kp.max_particles);
+        m_sort_indices_tmp.resize(kp.max_particles);
+        m_soa.resize(soa_capacity);
+        if (kp.enable_persistent_soa) {
+            m_soa_tmp.resize(soa_capacity);
+            m_soa_slots.resize(kp.max_particles);
+            m_soa_slots_tmp.resize(kp.max_particles);
+        }
+        else if (kp.enable_fused_update) {
+            // double buffer of fused update
+            m_soa_tmp.pos_x.resize(soa_capacity);
+            m_soa_tmp.pos_y.resize(soa_capacity);
+            m_soa_tmp.pos_z.resize(soa_capacity);
+            m_soa_tmp.vel_x.resize(soa_capacity);
+            m_soa_tmp.vel_y.resize(soa_capacity);
+            m_soa_tmp.vel_z.resize(soa_capacity);
         }
-        m_soa.resize(num_soa_data_blocks * 8);
     }
 
     mpCell              *ce = m_cells.data();
@@ -657,219 +1592,1139 @@ void mpWorld::update(float dt)
         kp.SPHLapViscosityCoef = m_kparams.SPHParticleMass * m_kparams.SPHViscosity * 45.0f / (PI * pow(m_kparams.particle_size, 6));
     }
 
-    mpKernelContext kcontext = {
-        &kp, ce,
-        m_soa.pos_x.data(), m_soa.pos_y.data(), m_soa.pos_z.data(),
-        m_soa.vel_x.data(), m_soa.vel_y.data(), m_soa.vel_z.data(),
-        m_soa.acl_x.data(), m_soa.acl_y.data(), m_soa.acl_z.data(),
-        m_soa.speed.data(), m_soa.density.data(), m_soa.affection.data(), m_soa.hit.data(),
-        planes, spheres, capsules, boxes, forces,
-        (int)m_plane_colliders.size(), (int)m_sphere_colliders.size(), (int)m_capsule_colliders.size(), (int)m_box_colliders.size(), (int)m_forces.size()
-    };
+    bool persistent_soa = kp.enable_persistent_soa != 0;
+    bool sparse_grid = kp.enable_sparse_grid != 0;
+    int num_soa = m_num_soa;
 
-    // clear grid
-    ist::parallel_for(0, cell_num, g_cells_par_task,
-        [&](int i) {
-            ce[i].begin = ce[i].end = 0;
-        });
+    // clear grid. only cells occupied last frame need to be cleared.
+    if (!sparse_grid && !cells_reallocated) {
+        eachOccupiedCell(
+            [&](int i) {
+                ce[i].begin = ce[i].end = 0;
+            });
+    }
 
     // gen hash
-    ist::parallel_for(0, m_num_particles, g_particles_par_task,
+    // particles [0, num_soa) are read from SoA data, others from m_particles (or aos_owner).
+    // m_sort_keys_prev keeps last frame's sorted keys for incremental sort.
+    int cell_bits = tp.world_div_bits.x + tp.world_div_bits.y + tp.world_div_bits.z;
+    u32 dead_flag = 1 << cell_bits;
+    m_sort_keys.swap(m_sort_keys_prev);
+    ist::parallel_for(0, m_num_particles, m_particles_par_task,
         [&](int i) {
-            vec3 rel = glm::abs((vec3&)m_particles[i].position - (vec3&)kp.active_region_center);
+            vec3 pos;
+            f32 *lifetime;
+            if (i < num_soa) {
+                int si = m_soa_slots[i];
+                pos = vec3(m_soa.pos_x[si], m_soa.pos_y[si], m_soa.pos_z[si]);
+                lifetime = &m_soa.lifetime[si];
+            }
+            else {
+                if (aos_owner) {
+                    m_particles[i] = aos_owner->particles[i];
+                    m_imd[i] = aos_owner->imd[i];
+                }
+                pos = (vec3&)m_particles[i].position;
+                lifetime = &m_particles[i].lifetime;
+            }
+            vec3 rel = glm::abs(pos - (vec3&)kp.active_region_center);
             if (rel.x > kp.active_region_extent.x ||
                 rel.y > kp.active_region_extent.y ||
                 rel.z > kp.active_region_extent.z)
             {
-                m_particles[i].lifetime = 0.0f;
+                *lifetime = 0.0f;
             }
-            m_particles[i].lifetime = std::max<f32>(m_particles[i].lifetime - dt, 0.0f);
-            m_particles[i].hash = mpGenHash(*this, m_particles[i]);
+            *lifetime = std::max<f32>(*lifetime - dt, 0.0f);
+            u32 hash = mpGenHash(kp, tp, pos, *lifetime);
+            if (i >= num_soa) {
+                m_particles[i].hash = hash;
+            }
+            m_sort_keys[i] = mpGenSortKey(hash, cell_bits);
+            m_sort_indices[i] = i;
         });
 
-    // sort by hash
-    ist::parallel_sort(m_particles.data(), m_particles.data() + m_num_particles,
-        [&](const mpParticle &a, const mpParticle &b) { return a.hash < b.hash; });
-
-    // count num particles
-    ist::parallel_for(0, m_num_particles, g_particles_par_task,
-        [&](int i) {
-            const u32 G_ID = i;
-            u32 G_ID_PREV = G_ID - 1;
-            u32 G_ID_NEXT = G_ID + 1;
+    // sort by hash (radix sort on keys & indices, then gather)
+    bool needs_gather = true;
+    bool sorted = false;
+    if (kp.enable_incremental_sort && m_num_sorted > 0) {
+        // particles that keep last frame's key at the same index are still in sorted order.
+        // sort only the others (moved or newly added) and merge them into the stayers.
+        int num = m_num_particles;
+        int num_prev = std::min<int>(m_num_sorted, num);
+        int num_blocks = ceildiv(num, m_particles_par_task);
+        m_sort_block_offsets.resize(num_blocks);
+        ist::parallel_for(0, num_blocks,
+            [&](int bi) {
+                int beg = bi * m_particles_par_task;
+                int end = std::min<int>(beg + m_particles_par_task, num_prev);
+                int n = 0;
+                for (int i = beg; i < end; ++i) {
+                    n += m_sort_keys[i] == m_sort_keys_prev[i];
+                }
+                m_sort_block_offsets[bi] = n;
+            });
+        int num_stayers = ist::parallel_scan(m_sort_block_offsets.data(), num_blocks);
+        int num_movers = num - num_stayers;
 
-            u32 cell = m_particles[G_ID].hash;
-            u32 cell_prev = (G_ID_PREV == -1) ? -1 : m_particles[G_ID_PREV].hash;
-            u32 cell_next = (G_ID_NEXT == kp.max_particles) ? -2 : m_particles[G_ID_NEXT].hash;
-            if ((cell & 0x80000000) != 0) { // highest bit is live flag
-                if ((cell_prev & 0x80000000) == 0) { // 
-                    m_num_particles = G_ID;
+        if (num_movers == 0) {
+            needs_gather = false;
+            sorted = true;
+        }
+        else if (num_movers <= int(num * g_incremental_sort_max_moved)) {
+            // stayers go to the head of tmp, movers to the tail
+            ist::parallel_for(0, num_blocks,
+                [&](int bi) {
+                    int beg = bi * m_particles_par_task;
+                    int end = std::min<int>(beg + m_particles_par_task, num);
+                    int si = m_sort_block_offsets[bi];
+                    int mi = num_stayers + (beg - si);
+                    for (int i = beg; i < end; ++i) {
+                        int di = (i < num_prev && m_sort_keys[i] == m_sort_keys_prev[i]) ? si++ : mi++;
+                        m_sort_keys_tmp[di] = m_sort_keys[i];
+                        m_sort_indices_tmp[di] = i;
+                    }
+                });
+            ist::parallel_radix_sort(&m_sort_keys_tmp[num_stayers], &m_sort_indices_tmp[num_stayers],
+                &m_sort_keys[num_stayers], &m_sort_indices[num_stayers], num_movers, cell_bits + 1);
+            ist::parallel_merge(
+                m_sort_keys_tmp.data(), m_sort_indices_tmp.data(), num_stayers,
+                &m_sort_keys_tmp[num_stayers], &m_sort_indices_tmp[num_stayers], num_movers,
+                m_sort_keys.data(), m_sort_indices.data());
+            sorted = true;
+        }
+    }
+    if (!sorted) {
+        ist::parallel_radix_sort(m_sort_keys.data(), m_sort_indices.data(), m_sort_keys_tmp.data(), m_sort_indices_tmp.data(),
+            m_num_particles, cell_bits + 1);
+    }
+    end_phase(m_timings.sort);
+
+    // count num particles and build list of occupied cells.
+    // each run of same keys is a cell. count runs of each block first, then fill cells in sorted order.
+    // on sparse grid, m_cells is compacted and index of a cell is its position in the list.
+    int num_sorted = m_num_particles;
+    int num_blocks = ceildiv(num_sorted, m_particles_par_task);
+    m_cell_task_offsets.resize(num_blocks + 1);
+    ist::parallel_for(0, num_blocks,
+        [&](int bi) {
+            int beg = bi * m_particles_par_task;
+            int end = std::min<int>(beg + m_particles_par_task, num_sorted);
+            int n = 0;
+            for (int i = beg; i < end; ++i) {
+                u32 cell = m_sort_keys[i];
+                if ((cell & dead_flag) != 0) { // dead flag is just above cell bits
+                    if (i == 0 || (m_sort_keys[i - 1] & dead_flag) == 0) {
+                        m_num_particles = i;
+                    }
+                    break;
                 }
+                if (i == 0 || cell != m_sort_keys[i - 1]) { ++n; }
             }
-            else {
-                if (cell != cell_prev) {
-                    ce[cell].begin = G_ID;
+            m_cell_task_offsets[bi] = n;
+        });
+    int num_cells = ist::parallel_scan(m_cell_task_offsets.data(), num_blocks);
+    m_cell_task_offsets[num_blocks] = num_cells;
+    m_occupied_cells.resize(num_cells);
+
+    int num_alive = m_num_particles;
+    ist::parallel_for(0, num_blocks,
+        [&](int bi) {
+            int beg = bi * m_particles_par_task;
+            int end = std::min<int>(beg + m_particles_par_task, num_alive);
+            int c = m_cell_task_offsets[bi] - 1;
+            for (int i = beg; i < end; ++i) {
+                u32 cell = m_sort_keys[i];
+                bool run_begin = i == 0 || cell != m_sort_keys[i - 1];
+                if (run_begin) { ++c; }
+                int ci = sparse_grid ? c : cell;
+                if (run_begin) {
+                    m_occupied_cells[c] = ci;
+                    ce[ci].begin = i;
+
+                    if (sparse_grid) {
+                        // coordinate of the cell (not wrapped) is taken from its first particle
+                        int pi = m_sort_indices[i];
+                        vec3 pos;
+                        if (pi < num_soa) {
+                            int si = m_soa_slots[pi];
+                            pos = vec3(m_soa.pos_x[si], m_soa.pos_y[si], m_soa.pos_z[si]);
+                        }
+                        else {
+                            pos = (vec3&)m_particles[pi].position;
+                        }
+                        (ivec3&)m_cell_coords[c] = mpGenCellCoord(tp, pos);
+                    }
                 }
-                if (cell != cell_next) {
-                    ce[cell].end = G_ID + 1;
+                if (i + 1 == num_alive || cell != m_sort_keys[i + 1]) {
+                    ce[ci].end = i + 1;
                 }
             }
         });
-    if ((m_particles[0].hash & 0x80000000) != 0) {
-        m_num_particles = 0;
+    m_num_sorted = m_num_particles;
+    m_num_cells = num_cells;
+
+    // SoA offset of each cell. each cell starts at aligned position.
+    // on row span mode, cells of each x-line are packed without padding so x-adjacent cells are contiguous.
+    // only lines are aligned, and they are the spans of SoA <-> AoS conversion.
+    bool row_spans = kp.enable_row_spans && (mpCellOrdering)kp.cell_ordering == mpCellOrdering::Linear;
+    bool soa_layout_changed = row_spans != m_soa_row_spans || soa_block_size != m_soa_block_size;
+    m_soa_row_spans = row_spans;
+    m_soa_block_size = soa_block_size;
+    if (!row_spans) {
+        ist::parallel_scan<i32>(num_cells,
+            [&](int i) {
+                const mpCell &c = ce[m_occupied_cells[i]];
+                return ceildiv(c.end - c.begin, soa_block_size) * soa_block_size;
+            },
+            [&](int i, i32 soai) {
+                ce[m_occupied_cells[i]].soai = soai;
+            });
+    }
+    else {
+        int bx = tp.world_div_bits.x;
+        auto line_begins = [&](int i) {
+            return i == 0 ||
+                (m_sort_keys[ce[m_occupied_cells[i]].begin] >> bx) != (m_sort_keys[ce[m_occupied_cells[i - 1]].begin] >> bx);
+        };
+        m_soa_lines.resize(num_cells);
+        m_soa_line_cells.resize(num_cells + 1);
+        int num_lines = ist::parallel_scan<int>(num_cells,
+            [&](int i) { return line_begins(i) ? 1 : 0; },
+            [&](int i, int li) {
+                if (line_begins(i)) {
+                    m_soa_lines[li].begin = ce[m_occupied_cells[i]].begin;
+                    m_soa_line_cells[li] = i;
+                }
+            });
+        m_soa_lines.resize(num_lines);
+        m_soa_line_cells[num_lines] = num_cells;
+
+        int num_alive = m_num_particles;
+        ist::parallel_scan<i32>(num_lines,
+            [&](int li) {
+                int end = li + 1 < num_lines ? m_soa_lines[li + 1].begin : num_alive;
+                return ceildiv(end - m_soa_lines[li].begin, soa_block_size) * soa_block_size;
+            },
+            [&](int li, i32 soai) {
+                mpCell &line = m_soa_lines[li];
+                line.end = li + 1 < num_lines ? m_soa_lines[li + 1].begin : num_alive;
+                line.soai = soai;
+                for (int i = m_soa_line_cells[li]; i < m_soa_line_cells[li + 1]; ++i) {
+                    mpCell &c = ce[m_occupied_cells[i]];
+                    c.soai = soai + (c.begin - line.begin);
+                }
+            });
+    }
+    if (sparse_grid) {
+        // open addressing hash table: cell key -> index of m_cells. keeps load factor <= 0.5.
+        // keys of cells are unique, so cells are inserted in parallel. a slot is claimed by CAS and then its value is written.
+        // order of insertion changes where keys end up, but not what lookups return.
+        int table_size = 16;
+        while (table_size < num_cells * 2) { table_size *= 2; }
+        m_cell_table_keys.resize(table_size);
+        m_cell_table_values.resize(table_size);
+        ist::parallel_for_blocked(0, table_size, g_particles_par_task,
+            [&](int begin, int end) {
+                std::fill(m_cell_table_keys.begin() + begin, m_cell_table_keys.begin() + end, 0xffffffff);
+            });
+        static_assert(sizeof(std::atomic<u32>) == sizeof(u32), "cell table keys are accessed as std::atomic<u32>");
+        std::atomic<u32> *keys = (std::atomic<u32>*)m_cell_table_keys.data();
+        u32 mask = table_size - 1;
+        ist::parallel_for(0, num_cells, m_particles_par_task,
+            [&](int i) {
+                u32 key = m_sort_keys[ce[i].begin];
+                for (u32 h = mpCellKeyHash(key) & mask; ; h = (h + 1) & mask) {
+                    u32 empty = 0xffffffff;
+                    if (keys[h].load(std::memory_order_relaxed) == empty &&
+                        keys[h].compare_exchange_strong(empty, key, std::memory_order_relaxed))
+                    {
+                        m_cell_table_values[h] = i;
+                        break;
+                    }
+                }
+            });
     }
 
+    // tasks of per-cell passes. m_cell_task_offsets held cell counts of the blocks above, and is rebuilt here.
+    // occupied cells are split at equal steps of prefix sum of estimated work, so crowded cells get tasks of their own.
+    // work of a cell with n particles is n * (n + bias): interaction pairs of a crowded cell are mostly its own.
     {
-        i32 soai = 0;
-        for (int i = 0; i < cell_num; ++i) {
-            ce[i].soai = soai;
-            soai += soa_blocks(ce[i].end - ce[i].begin);
+        bool pairs = kp.enable_interaction != 0;
+        m_cell_weights.resize(num_cells + 1);
+        float total_weight = ist::parallel_scan<float>(num_cells,
+            [&](int i) {
+                const mpCell &c = ce[m_occupied_cells[i]];
+                float n = float(c.end - c.begin);
+                return pairs ? n * (n + g_cell_weight_bias) : n;
+            },
+            [&](int i, float w) { m_cell_weights[i] = w; });
+        m_cell_weights[num_cells] = total_weight;
+
+        int num_tasks = std::min<int>(ist::num_threads() * m_cell_tasks_par_thread, num_cells);
+        num_tasks = std::min<int>(num_tasks, ceildiv(m_num_particles, g_min_particles_par_cell_task));
+        m_cell_task_offsets.resize(num_tasks + 1);
+        auto weights_end = m_cell_weights.begin() + num_cells;
+        for (int ti = 0; ti < num_tasks; ++ti) {
+            float w = total_weight * ti / num_tasks;
+            m_cell_task_offsets[ti] = int(std::lower_bound(m_cell_weights.begin(), weights_end, w) - m_cell_weights.begin());
         }
+        m_cell_task_offsets[num_tasks] = num_cells;
+        // cells heavier than a task leave empty tasks
+        m_cell_task_offsets.erase(std::unique(m_cell_task_offsets.begin(), m_cell_task_offsets.end()), m_cell_task_offsets.end());
     }
 
-    // AoS -> SoA
-    ist::parallel_for(0, cell_num, g_cells_par_task,
-        [&](int i) {
-            i32 n = ce[i].end - ce[i].begin;
-            if (n == 0) { return; }
-            mpSoAnize(ce[i], m_particles, m_soa);
-        });
+    // dense cells: particles piled up in a cell make neighbor search of 27 cells quadratic.
+    // particles of such cells are sorted along the axis they spread most, and kernels binary search
+    // the particles in interaction range instead of visiting all of them (GetNeighborWindow() in mpCore.ispc).
+    // impulse solver applies advection of all particles of neighbor cells, not only of those in interaction range.
+    // narrowing would drop some of them, so it sorts dense cells only without advection.
+    bool dense_cells = kp.dense_cell_threshold > 0 && kp.enable_interaction &&
+        !((mpSolverType)kp.solver_type == mpSolverType::Impulse && kp.advection != 0.0f);
+    bool has_dense_cells = false;
+    if (m_cell_sort_axis.size() != m_cells.size()) {
+        m_cell_sort_axis.assign(m_cells.size(), -1);
+    }
+    else {
+        for (int ci : m_dense_cells) { m_cell_sort_axis[ci] = -1; }
+    }
+    m_dense_cells.clear();
+    if (dense_cells) {
+        auto is_dense = [&](int i) {
+            const mpCell &c = ce[m_occupied_cells[i]];
+            return c.end - c.begin > kp.dense_cell_threshold;
+        };
+        m_dense_cells.resize(num_cells);
+        int num_dense = ist::parallel_scan<i32>(num_cells,
+            [&](int i) { return is_dense(i) ? 1 : 0; },
+            [&](int i, i32 di) { if (is_dense(i)) { m_dense_cells[di] = m_occupied_cells[i]; } });
+        m_dense_cells.resize(num_dense);
+    }
+    if (!m_dense_cells.empty()) {
+        has_dense_cells = true;
+        auto source_position = [&](int pi) {
+            if (pi < num_soa) {
+                int si = m_soa_slots[pi];
+                return vec3(m_soa.pos_x[si], m_soa.pos_y[si], m_soa.pos_z[si]);
+            }
+            return (vec3&)m_particles[pi].position;
+        };
+        ist::parallel_for(0, (int)m_dense_cells.size(), 1,
+            [&](int di) {
+                int ci = m_dense_cells[di];
+                const mpCell &c = ce[ci];
+                mpAxisKeyCont &keys = m_dense_keys.local();
+                keys.resize(c.end - c.begin);
+                vec3 bl = source_position(m_sort_indices[c.begin]), ur = bl;
+                for (int i = c.begin; i < c.end; ++i) {
+                    vec3 pos = source_position(m_sort_indices[i]);
+                    bl = glm::min(bl, pos);
+                    ur = glm::max(ur, pos);
+                }
+                vec3 size = ur - bl;
+                int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+                for (int i = c.begin; i < c.end; ++i) {
+                    int pi = m_sort_indices[i];
+                    keys[i - c.begin] = std::make_pair(source_position(pi)[axis], pi);
+                }
+                std::sort(keys.begin(), keys.end());
+                for (int i = c.begin; i < c.end; ++i) {
+                    m_sort_indices[i] = keys[i - c.begin].second;
+                }
+                m_cell_sort_axis[ci] = (i8)axis;
+            });
+        // particles are reordered. gather them even if no particles moved to other cells.
+        needs_gather = true;
+    }
+    end_phase(m_timings.cells);
+
+    if (!persistent_soa) {
+        if (needs_gather) {
+            ist::parallel_for(0, num_sorted, m_particles_par_task,
+                [&](int i) {
+                    int si = m_sort_indices[i];
+                    m_particles_tmp[i] = m_particles[si];
+                    m_imd_tmp[i] = m_imd[si];
+                });
+            m_particles.swap(m_particles_tmp);
+            m_imd.swap(m_imd_tmp);
+        }
 
+        // AoS -> SoA
+        eachSoASpan(
+            [&](const mpCell &span) {
+                mpSoAnize(span, m_particles, m_soa);
+            });
+    }
+    else if (!needs_gather && !soa_layout_changed && num_soa >= m_num_particles) {
+        // no particles moved and all are in SoA data. layout is unchanged, just shift hit flags.
+        ist::parallel_for(0, m_num_particles, m_particles_par_task,
+            [&](int i) {
+                int si = m_soa_slots[i];
+                m_soa.hit_prev[si] = m_soa.hit[si];
+                m_soa.hit[si] = 0;
+            });
+    }
+    else {
+        // gather live particles into new SoA layout. sources are previous SoA data or m_particles.
+        auto gather = [&](int i, int di) {
+            m_soa_slots_tmp[i] = di;
+
+            int pi = m_sort_indices[i];
+            if (pi < num_soa) {
+                int si = m_soa_slots[pi];
+                m_soa_tmp.pos_x[di] = m_soa.pos_x[si];
+                m_soa_tmp.pos_y[di] = m_soa.pos_y[si];
+                m_soa_tmp.pos_z[di] = m_soa.pos_z[si];
+                m_soa_tmp.vel_x[di] = m_soa.vel_x[si];
+                m_soa_tmp.vel_y[di] = m_soa.vel_y[si];
+                m_soa_tmp.vel_z[di] = m_soa.vel_z[si];
+                m_soa_tmp.acl_x[di] = m_soa.acl_x[si];
+                m_soa_tmp.acl_y[di] = m_soa.acl_y[si];
+                m_soa_tmp.acl_z[di] = m_soa.acl_z[si];
+                m_soa_tmp.speed[di] = m_soa.speed[si];
+                m_soa_tmp.density[di] = m_soa.density[si];
+                m_soa_tmp.lifetime[di] = m_soa.lifetime[si];
+                m_soa_tmp.id[di] = m_soa.id[si];
+                m_soa_tmp.userdata[di] = m_soa.userdata[si];
+                m_soa_tmp.hit_prev[di] = m_soa.hit[si];
+            }
+            else {
+                const mpParticle &p = m_particles[pi];
+                const vec4 &pos = (vec4&)p.position;
+                const vec4 &vel = (vec4&)p.velocity;
+                const vec4 &acl = (vec4&)m_imd[pi].accel;
+                m_soa_tmp.pos_x[di] = pos.x;
+                m_soa_tmp.pos_y[di] = pos.y;
+                m_soa_tmp.pos_z[di] = pos.z;
+                m_soa_tmp.vel_x[di] = vel.x;
+                m_soa_tmp.vel_y[di] = vel.y;
+                m_soa_tmp.vel_z[di] = vel.z;
+                m_soa_tmp.acl_x[di] = acl.x;
+                m_soa_tmp.acl_y[di] = acl.y;
+                m_soa_tmp.acl_z[di] = acl.z;
+                m_soa_tmp.speed[di] = vel.w;
+                m_soa_tmp.density[di] = 0.0f;
+                m_soa_tmp.lifetime[di] = p.lifetime;
+                m_soa_tmp.id[di] = p.id;
+                m_soa_tmp.userdata[di] = p.userdata;
+                m_soa_tmp.hit_prev[di] = p.hit;
+            }
+            m_soa_tmp.hit[di] = 0;
+        };
+        eachOccupiedCell(
+            [&](int ci) {
+                const mpCell &c = ce[ci];
+                int di = c.soai;
+                for (int i = c.begin; i < c.end; ++i) {
+                    gather(i, di++);
+                }
+            });
+        std::swap(m_soa, m_soa_tmp);
+        m_soa_slots.swap(m_soa_slots_tmp);
+    }
+    end_phase(m_timings.soa);
 
     mpSolverType solver_type = (mpSolverType)m_kparams.solver_type;
-    if (solver_type == mpSolverType::Impulse) {
-        // impulse
-        ist::parallel_for(0, cell_num, g_cells_par_task,
+    // impulse advection of cell stencils reaches particles out of interaction range, which lists don't have.
+    // like dense cells, impulse solver uses lists only without advection so that results don't depend on them.
+    bool neighbor_lists = kp.enable_neighbor_lists && kp.enable_interaction &&
+        (solver_type == mpSolverType::SPH || (solver_type == mpSolverType::Impulse && kp.advection == 0.0f));
+    if (neighbor_lists) {
+        updateNeighborLists(num_sorted, needs_gather);
+    }
+    else {
+        m_nlists.valid = false;
+    }
+    end_phase(m_timings.neighbor_lists);
+
+    mpKernelContext kcontext = {
+        &kp, ce,
+        m_soa.pos_x.data(), m_soa.pos_y.data(), m_soa.pos_z.data(),
+        m_soa.vel_x.data(), m_soa.vel_y.data(), m_soa.vel_z.data(),
+        m_soa.acl_x.data(), m_soa.acl_y.data(), m_soa.acl_z.data(),
+        m_soa.speed.data(), m_soa.density.data(), m_soa.affection.data(), m_soa.hit.data(),
+        planes, spheres, capsules, boxes, forces,
+        (int)m_plane_colliders.size(), (int)m_sphere_colliders.size(), (int)m_capsule_colliders.size(), (int)m_box_colliders.size(), (int)m_forces.size(),
+        sparse_grid ? m_cell_table_keys.data() : nullptr,
+        sparse_grid ? m_cell_table_values.data() : nullptr,
+        sparse_grid ? (int)m_cell_table_keys.size() - 1 : 0,
+        tp.cell_key_x, tp.cell_key_y, tp.cell_key_z,
+        m_nlists.offsets.data(), m_nlists.indices.data(), m_nlists.slots.data(),
+        m_soa_tmp.pos_x.data(), m_soa_tmp.pos_y.data(), m_soa_tmp.pos_z.data(),
+        m_soa_tmp.vel_x.data(), m_soa_tmp.vel_y.data(), m_soa_tmp.vel_z.data(),
+        has_dense_cells ? m_cell_sort_axis.data() : nullptr
+    };
+    auto gen_index = [&](int i, ispc::vec3i &idx) {
+        if (sparse_grid) { idx = m_cell_coords[i]; }
+        else { mpGenIndex(*this, i, idx); }
+    };
+
+    // per-cell kernels after interaction are selected once here. forces and colliders are skipped if there are none.
+    bool has_forces = kp.enable_forces && !m_forces.empty();
+    bool has_colliders = kp.enable_colliders && num_colliders > 0;
+    bool scale = (vec3&)kp.coord_scaler != vec3(1.0f, 1.0f, 1.0f);
+    mpCellKernel process_cell = mpSelectCellKernel(has_forces, has_colliders, true, scale);
+
+    // half shell mode: each cell writes accel of itself and its forward neighbors (x-1..x+1, y..y+1, z-1..z+1).
+    // cells are colored by coordinate so that cells of the same color never write the same cell.
+    // sparse grid with less than 3 cells on an axis uses full stencil, because wrapped neighbors alias there.
+    // cells with many particles run particle-parallel kernels. SIMD lanes are filled with own particles and
+    // no horizontal reduction is needed. cells with few particles are better vectorized across neighbors.
+    int by_particle_min = kp.particle_parallel_threshold;
+    if (by_particle_min == 0) { by_particle_min = std::max<int>(ispc::GetProgramCount() / 2, 1); }
+    else if (by_particle_min < 0) { by_particle_min = std::numeric_limits<int>::max(); }
+    auto by_particle = [&](int i) { return ce[i].end - ce[i].begin >= by_particle_min; };
+
+    // neighbor lists take precedence over half shell.
+    bool half_shell = !neighbor_lists && kp.enable_half_shell && kp.enable_interaction &&
+        (!sparse_grid || (kp.world_div.x >= 3 && kp.world_div.y >= 3 && kp.world_div.z >= 3));
+    if (half_shell) {
+        // sparse grid wraps around div. cells in the remainder of div / period get their own colors.
+        auto axis_colors = [&](int div, int period) {
+            return sparse_grid ? period + div % period : period;
+        };
+        auto axis_color = [&](int i, int div, int period) {
+            if (!sparse_grid) { return i % period; }
+            i &= div - 1;
+            int tail = div - div % period;
+            return i < tail ? i % period : period + (i - tail);
+        };
+        int ncx = axis_colors(kp.world_div.x, 3);
+        int ncy = axis_colors(kp.world_div.y, 2);
+        int ncz = axis_colors(kp.world_div.z, 3);
+        int num_colors = ncx * ncy * ncz;
+        auto cell_color = [&](int ci) {
+            ispc::vec3i idx;
+            gen_index(ci, idx);
+            int cy = axis_color(idx.y, kp.world_div.y, 2);
+            int cz = axis_color(idx.z, kp.world_div.z, 3);
+            int cx = axis_color(idx.x, kp.world_div.x, 3);
+            return (cy * ncz + cz) * ncx + cx;
+        };
+
+        // counting sort of occupied cells by color
+        int num_tasks = (int)m_cell_task_offsets.size() - 1;
+        m_color_task_offsets.resize(num_tasks * num_colors);
+        m_color_offsets.resize(num_colors + 1);
+        m_colored_cells.resize(m_num_cells);
+        ist::parallel_for(0, num_tasks,
+            [&](int ti) {
+                int *counts = &m_color_task_offsets[ti * num_colors];
+                std::fill(counts, counts + num_colors, 0);
+                int end = m_cell_task_offsets[ti + 1];
+                for (int i = m_cell_task_offsets[ti]; i < end; ++i) {
+                    ++counts[cell_color(m_occupied_cells[i])];
+                }
+            });
+        int total = 0;
+        for (int c = 0; c < num_colors; ++c) {
+            m_color_offsets[c] = total;
+            for (int ti = 0; ti < num_tasks; ++ti) {
+                int &o = m_color_task_offsets[ti * num_colors + c];
+                int n = o;
+                o = total;
+                total += n;
+            }
+        }
+        m_color_offsets[num_colors] = total;
+        ist::parallel_for(0, num_tasks,
+            [&](int ti) {
+                int *offsets = &m_color_task_offsets[ti * num_colors];
+                int end = m_cell_task_offsets[ti + 1];
+                for (int i = m_cell_task_offsets[ti]; i < end; ++i) {
+                    int ci = m_occupied_cells[i];
+                    m_colored_cells[offsets[cell_color(ci)]++] = ci;
+                }
+            });
+    }
+    // half shell kernels accumulate into accel
+    auto clear_accel = [&]() {
+        eachSoASpan(
+            [&](const mpCell &span) {
+                int n = span.end - span.begin;
+                std::fill_n(&m_soa.acl_x[span.soai], n, 0.0f);
+                std::fill_n(&m_soa.acl_y[span.soai], n, 0.0f);
+                std::fill_n(&m_soa.acl_z[span.soai], n, 0.0f);
+            });
+    };
+    auto update_sph_force = [&]() {
+        if (neighbor_lists) {
+            ist::parallel_for_blocked(0, m_nlists.num_rows, m_particles_par_task,
+                [&](int beg, int end) {
+                    ispc::sphUpdateForceList(kcontext, beg, end);
+                });
+        }
+        else if (half_shell) {
+            clear_accel();
+            eachColoredCell(
+                [&](int i) {
+                    ispc::vec3i idx;
+                    gen_index(i, idx);
+                    ispc::sphUpdateForceHalf(kcontext, idx);
+                });
+        }
+        else {
+            eachOccupiedCell(
+                [&](int i) {
+                    ispc::vec3i idx;
+                    gen_index(i, idx);
+                    if (by_particle(i)) {
+                        ispc::sphUpdateForceByParticle(kcontext, idx);
+                    }
+                    else {
+                        ispc::sphUpdateForce(kcontext, idx);
+                    }
+                });
+        }
+    };
+
+    if (solver_type == mpSolverType::Impulse && (half_shell || neighbor_lists)) {
+        // impulse, half shell or neighbor lists. forces & colliders touch only own cell, so they run with integration.
+        if (neighbor_lists) {
+            ist::parallel_for_blocked(0, m_nlists.num_rows, m_particles_par_task,
+                [&](int beg, int end) {
+                    ispc::impUpdatePressureList(kcontext, beg, end);
+                });
+        }
+        else {
+            clear_accel();
+            eachColoredCell(
+                [&](int i) {
+                    ispc::vec3i idx;
+                    gen_index(i, idx);
+                    ispc::impUpdatePressureHalf(kcontext, idx);
+                });
+        }
+        eachOccupiedCell(
             [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                if (n == 0) { return; }
                 ispc::vec3i idx;
-                mpGenIndex(*this, i, idx);
-                if (kp.enable_interaction) {
-                    ispc::impUpdatePressure(kcontext, idx);
+                gen_index(i, idx);
+                process_cell(kcontext, idx);
+            });
+    }
+    else if (solver_type == mpSolverType::Impulse && kp.enable_interaction && kp.enable_fused_update) {
+        // impulse, fused. one sweep over cells. positions and velocities are double buffered (m_soa_tmp is free
+        // after the gather), so interaction of a cell can read its neighbors even if they are already integrated.
+        // each task processes a contiguous range of cells, so neighbor data loaded for a cell is reused by the next ones.
+        mpImpulseCellKernel process_impulse_cell = mpSelectImpulseCellKernel(has_forces, has_colliders, scale);
+        eachOccupiedCell(
+            [&](int i) {
+                ispc::vec3i idx;
+                gen_index(i, idx);
+                process_impulse_cell(kcontext, idx, by_particle(i));
+            });
+        m_soa.pos_x.swap(m_soa_tmp.pos_x);
+        m_soa.pos_y.swap(m_soa_tmp.pos_y);
+        m_soa.pos_z.swap(m_soa_tmp.pos_z);
+        m_soa.vel_x.swap(m_soa_tmp.vel_x);
+        m_soa.vel_y.swap(m_soa_tmp.vel_y);
+        m_soa.vel_z.swap(m_soa_tmp.vel_z);
+    }
+    else if (solver_type == mpSolverType::Impulse && kp.enable_interaction) {
+        // impulse. interaction reads neighbor cells, so integration of a tile runs after interaction of tiles around it.
+        mpCellKernel process_cell_pre = mpSelectCellKernel(has_forces, has_colliders, false, false);
+        mpCellKernel integrate = mpSelectCellKernel(false, false, true, scale);
+        eachOccupiedCellPhased(2,
+            [&](int phase, int i) {
+                ispc::vec3i idx;
+                gen_index(i, idx);
+                if (phase == 1) {
+                    integrate(kcontext, idx);
+                    return;
+                }
+                if (by_particle(i)) {
+                    ispc::impUpdatePressureByParticle(kcontext, idx);
                 }
-                if (kp.enable_forces) {
-                    ispc::ProcessExternalForce(kcontext, idx);
+                else {
+                    ispc::impUpdatePressure(kcontext, idx);
                 }
-                if (kp.enable_colliders) {
-                    ispc::ProcessColliders(kcontext, idx);
+                if (process_cell_pre) {
+                    process_cell_pre(kcontext, idx);
                 }
             });
-        ist::parallel_for(0, cell_num, g_cells_par_task,
+    }
+    else if (solver_type == mpSolverType::Impulse) {
+        // impulse without interaction. every kernel touches only own cell.
+        eachOccupiedCell(
             [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                if (n == 0) { return; }
                 ispc::vec3i idx;
-                mpGenIndex(*this, i, idx);
-                ispc::Integrate(kcontext, idx);
+                gen_index(i, idx);
+                process_cell(kcontext, idx);
+            });
+    }
+    else if ((solver_type == mpSolverType::SPH || solver_type == mpSolverType::SPHEst) &&
+        kp.enable_interaction && !neighbor_lists && !half_shell)
+    {
+        // sph on cells. each pass reads results of previous pass of neighbor cells.
+        // passes run as a graph of tiles, so a tile doesn't wait for tiles that are not around it.
+        bool est = solver_type == mpSolverType::SPHEst;
+        eachOccupiedCellPhased(est ? 4 : 3,
+            [&](int phase, int i) {
+                ispc::vec3i idx;
+                gen_index(i, idx);
+                switch (est ? phase : phase + 1) {
+                case 0:
+                    ispc::sphUpdateDensityEst1(kcontext, idx);
+                    break;
+                case 1:
+                    if (est) { ispc::sphUpdateDensityEst2(kcontext, idx); }
+                    else if (by_particle(i)) { ispc::sphUpdateDensityByParticle(kcontext, idx); }
+                    else { ispc::sphUpdateDensity(kcontext, idx); }
+                    break;
+                case 2:
+                    if (by_particle(i)) { ispc::sphUpdateForceByParticle(kcontext, idx); }
+                    else { ispc::sphUpdateForce(kcontext, idx); }
+                    break;
+                case 3:
+                    process_cell(kcontext, idx);
+                    break;
+                }
             });
     }
     else if (solver_type == mpSolverType::SPH || solver_type == mpSolverType::SPHEst) {
         if (kp.enable_interaction && solver_type == mpSolverType::SPH) {
-            ist::parallel_for(0, cell_num, g_cells_par_task,
-                [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateDensity(kcontext, idx);
-                });
-            ist::parallel_for(0, cell_num, g_cells_par_task,
-                [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateForce(kcontext, idx);
-                });
+            if (neighbor_lists) {
+                ist::parallel_for_blocked(0, m_nlists.num_rows, m_particles_par_task,
+                    [&](int beg, int end) {
+                        ispc::sphUpdateDensityList(kcontext, beg, end);
+                    });
+            }
+            else {
+                eachOccupiedCell(
+                    [&](int i) {
+                        ispc::vec3i idx;
+                        gen_index(i, idx);
+                        if (by_particle(i)) {
+                            ispc::sphUpdateDensityByParticle(kcontext, idx);
+                        }
+                        else {
+                            ispc::sphUpdateDensity(kcontext, idx);
+                        }
+                    });
+            }
+            update_sph_force();
         }
         else if (kp.enable_interaction && solver_type == mpSolverType::SPHEst) {
-            ist::parallel_for(0, cell_num, g_cells_par_task,
+            eachOccupiedCell(
                 [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
                     ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
+                    gen_index(i, idx);
                     ispc::sphUpdateDensityEst1(kcontext, idx);
                 });
-            ist::parallel_for(0, cell_num, g_cells_par_task,
+            eachOccupiedCell(
                 [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
                     ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
+                    gen_index(i, idx);
                     ispc::sphUpdateDensityEst2(kcontext, idx);
                 });
-            ist::parallel_for(0, cell_num, g_cells_par_task,
-                [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateForce(kcontext, idx);
-                });
+            update_sph_force();
         }
 
-        ist::parallel_for(0, cell_num, g_cells_par_task,
+        eachOccupiedCell(
             [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                if (n == 0) { return; }
                 ispc::vec3i idx;
-                mpGenIndex(*this, i, idx);
-                if (kp.enable_forces) {
-                    ispc::ProcessExternalForce(kcontext, idx);
-                }
-                if (kp.enable_colliders) {
-                    ispc::ProcessColliders(kcontext, idx);
-                }
-                ispc::Integrate(kcontext, idx);
+                gen_index(i, idx);
+                process_cell(kcontext, idx);
             });
     }
+    end_phase(m_timings.kernels);
 
-    // SoA -> AoS
-    ist::parallel_for(0, cell_num, g_cells_par_task,
-        [&](int i) {
-            i32 n = ce[i].end - ce[i].begin;
-            if (n == 0) { return; }
-            mpAoSnize(ce[i], m_soa, m_particles, m_imd);
-        });
+    if (!persistent_soa) {
+        // SoA -> AoS
+        eachSoASpan(
+            [&](const mpCell &span) {
+                mpAoSnize(span, m_soa, m_particles, m_imd);
+            });
+    }
+    else {
+        // AoS view will be built when someone requests it
+        m_num_soa = m_num_particles;
+        m_aos_valid = false;
+    }
+    end_phase(m_timings.aos);
 
     // make clone data for GPU
+    // fill the snapshot render thread doesn't hold and publish it. render thread never waits for this.
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        int num_particles_needs_copy = std::max<int>(m_num_particles, m_num_particles_gpu);
-        m_num_particles_gpu = m_num_particles;
-        if (num_particles_needs_copy > 0) {
-            memcpy(m_particles_gpu.data(), m_particles.data(), sizeof(mpParticle)*num_particles_needs_copy);
+        mpRenderSnapshot &snap = m_snapshots.back();
+        int layout = kp.data_texture_layout;
+        size_t stride = mpGetRenderDataStride(layout);
+        // whole lines of data texture can be read
+        size_t line = mpDataTextureWidth * gi::GraphicsInterface::GetTexelSize(mpGetDataTextureFormat(layout));
+        size_t capacity = line * ceildiv(stride*m_particles.size(), line);
+        if (snap.layout != layout || snap.data.size() != capacity) {
+            snap.data.assign(capacity, 0);
+            snap.layout = layout;
+            snap.num_particles = 0;
+        }
+        int num_particles_needs_clear = std::max<int>(m_num_particles, snap.num_particles);
+        snap.num_particles = m_num_particles;
+        u8 *dst = snap.data.data();
+        const vec3 &center = (vec3&)kp.world_center;
+        bool id_as_float = kp.id_as_float != 0;
+        if (layout == (int)mpDataTextureLayout::Full) {
+            if (!persistent_soa) {
+                memcpy(dst, m_particles.data(), stride*m_num_particles);
+            }
+            else {
+                // SoA -> GPU data directly
+                eachSoASpan(
+                    [&](const mpCell &span) {
+                        mpAoSnizeFull(span, m_soa, (mpParticle*)dst, nullptr);
+                    });
+            }
+        }
+        else {
+            if (!persistent_soa) {
+                ist::parallel_for_blocked(0, m_num_particles, m_particles_par_task,
+                    [&](int beg, int end) {
+                        mpPackRenderDataAoS(layout, m_particles.data(), beg, end, center, id_as_float, dst);
+                    });
+            }
+            else {
+                eachSoASpan(
+                    [&](const mpCell &span) {
+                        mpPackRenderDataSoA(layout, span, m_soa, center, id_as_float, dst);
+                    });
+            }
+        }
+        // particles that died since this snapshot was written are hidden by zero lifetime
+        if (num_particles_needs_clear > m_num_particles) {
+            memset(dst + stride*m_num_particles, 0, stride*(num_particles_needs_clear - m_num_particles));
+        }
+        m_snapshots.publish();
+    }
+    end_phase(m_timings.gpu_copy);
+    m_timings.total = std::chrono::duration<float, std::milli>(time_phase - time_begin).count();
+
+    if (tune_grain) {
+        m_particles_tuner.feed(m_timings.sort + m_timings.cells, m_num_particles);
+        m_cells_tuner.feed(m_timings.soa + m_timings.kernels + m_timings.aos, m_num_particles);
+    }
+}
+
+void mpWorld::updateNeighborLists(int num_sorted, bool needs_gather)
+{
+    mpKernelParams &kp = m_kparams;
+    mpTempParams &tp = m_tparams;
+    mpNeighborLists &nl = m_nlists;
+    bool sparse_grid = kp.enable_sparse_grid != 0;
+    int num = m_num_particles;
+    float range = (mpSolverType)kp.solver_type == mpSolverType::Impulse ? kp.particle_size * 2.0f : kp.particle_size;
+    float skin = std::max<float>(kp.neighbor_list_skin, 0.0f);
+
+    // SoA index of each sorted particle. persistent SoA mode already has it.
+    if (!kp.enable_persistent_soa) {
+        m_soa_slots.resize(kp.max_particles);
+        eachOccupiedCell(
+            [&](int ci) {
+                const mpCell &c = m_cells[ci];
+                for (int i = c.begin; i < c.end; ++i) {
+                    m_soa_slots[i] = c.soai + (i - c.begin);
+                }
+            });
+    }
+
+    bool rebuild = !nl.valid || nl.range != range || nl.skin != skin;
+    if (!rebuild) {
+        // follow particle of each row to its current sorted index
+        if (needs_gather) {
+            nl.work.resize(num_sorted);
+            ist::parallel_for(0, num_sorted, m_particles_par_task,
+                [&](int i) {
+                    nl.work[m_sort_indices[i]] = i;
+                });
+            ist::parallel_for(0, nl.num_rows, m_particles_par_task,
+                [&](int b) {
+                    int &i = nl.sorted[b];
+                    if (i >= 0) {
+                        i = nl.work[i];
+                        if (i >= num) { i = -1; }
+                    }
+                });
         }
+
+        // lists can miss pairs once a particle moved more than half the skin since the build
+        float limit_sq = (skin * 0.5f) * (skin * 0.5f);
+        int num_blocks = ceildiv(nl.num_rows, m_particles_par_task);
+        std::vector<int> moved(num_blocks);
+        ist::parallel_for(0, num_blocks,
+            [&](int bi) {
+                int beg = bi * m_particles_par_task;
+                int end = std::min<int>(beg + m_particles_par_task, nl.num_rows);
+                int m = 0;
+                for (int b = beg; b < end; ++b) {
+                    int i = nl.sorted[b];
+                    int si = i >= 0 ? m_soa_slots[i] : -1;
+                    nl.slots[b] = si;
+                    if (si >= 0) {
+                        vec3 d = vec3(m_soa.pos_x[si] - nl.pos_x[b], m_soa.pos_y[si] - nl.pos_y[b], m_soa.pos_z[si] - nl.pos_z[b]);
+                        m |= glm::dot(d, d) > limit_sq;
+                    }
+                }
+                moved[bi] = m;
+            });
+        rebuild = std::find(moved.begin(), moved.end(), 1) != moved.end();
     }
+    if (!rebuild) { return; }
+
+    nl.valid = true;
+    nl.range = range;
+    nl.skin = skin;
+    nl.num_rows = num;
+    nl.offsets.resize(num + 1);
+    nl.sorted.resize(num);
+    nl.slots.resize(num);
+    nl.work.resize(num);
+    nl.pos_x.resize(num);
+    nl.pos_y.resize(num);
+    nl.pos_z.resize(num);
+    ist::parallel_for(0, num, m_particles_par_task,
+        [&](int i) {
+            int si = m_soa_slots[i];
+            nl.offsets[i] = 0;
+            nl.sorted[i] = i;
+            nl.slots[i] = si;
+            nl.pos_x[i] = m_soa.pos_x[si];
+            nl.pos_y[i] = m_soa.pos_y[si];
+            nl.pos_z[i] = m_soa.pos_z[si];
+        });
+
+    // candidate cells. range + skin may exceed cell size, so number of neighbor cells on each axis is computed from it.
+    // same wrapping rules as GetNeighborRange() in mpCore.ispc.
+    float cutoff = range + skin;
+    float cutoff_sq = cutoff * cutoff;
+    ivec3 reach = glm::max(ivec3(glm::ceil(vec3(cutoff) * (vec3&)tp.rcp_cell_size)), ivec3(1));
+    auto neighbor_range = [&](int i, int div, int r, int &beg, int &end) {
+        if (!sparse_grid) {
+            beg = std::max<int>(i - r, 0);
+            end = std::min<int>(i + r, div - 1);
+        }
+        else if (div >= r * 2 + 1) {
+            beg = i - r;
+            end = i + r;
+        }
+        else {
+            beg = i - (i & (div - 1));
+            end = beg + div - 1;
+        }
+    };
+
+    // count pairs, then fill them in. both passes run same distance tests.
+    auto each_pair_pass = [&](bool fill) {
+        eachOccupiedCell(
+            [&](int ci) {
+                const mpCell &c = m_cells[ci];
+                ivec3 idx;
+                if (sparse_grid) { idx = (ivec3&)m_cell_coords[ci]; }
+                else { mpGenIndex(*this, ci, (ispc::vec3i&)idx); }
+                ivec3 nbeg, nend;
+                neighbor_range(idx.x, kp.world_div.x, reach.x, nbeg.x, nend.x);
+                neighbor_range(idx.y, kp.world_div.y, reach.y, nbeg.y, nend.y);
+                neighbor_range(idx.z, kp.world_div.z, reach.z, nbeg.z, nend.z);
+                for (int ny = nbeg.y; ny <= nend.y; ++ny) {
+                    for (int nz = nbeg.z; nz <= nend.z; ++nz) {
+                        for (int nx = nbeg.x; nx <= nend.x; ++nx) {
+                            int nci = findCell(ivec3(nx, ny, nz));
+                            if (nci < 0) { continue; }
+                            const mpCell &n = m_cells[nci];
+                            for (int i = c.begin; i < c.end; ++i) {
+                                int si = c.soai + (i - c.begin);
+                                vec3 pos1 = vec3(m_soa.pos_x[si], m_soa.pos_y[si], m_soa.pos_z[si]);
+                                int count = 0;
+                                int *dst = fill ? &nl.indices[nl.work[i]] : nullptr;
+                                for (int j = n.begin; j < n.end; ++j) {
+                                    int sj = n.soai + (j - n.begin);
+                                    vec3 d = vec3(m_soa.pos_x[sj], m_soa.pos_y[sj], m_soa.pos_z[sj]) - pos1;
+                                    if (j != i && glm::dot(d, d) < cutoff_sq) {
+                                        if (fill) { dst[count] = j; }
+                                        ++count;
+                                    }
+                                }
+                                (fill ? nl.work[i] : nl.offsets[i]) += count;
+                            }
+                        }
+                    }
+                }
+            });
+    };
+    each_pair_pass(false);
+    int num_pairs = ist::parallel_scan(nl.offsets.data(), num);
+    nl.offsets[num] = num_pairs;
+    nl.indices.resize(num_pairs);
+    ist::parallel_for(0, num, m_particles_par_task,
+        [&](int i) {
+            nl.work[i] = nl.offsets[i];
+        });
+    each_pair_pass(true);
 }
 
 void mpWorld::beginUpdate(float dt)
 {
-    m_taskgroup.run([=]() { update(dt); });
+    // two updates of a world never run at once
+    endUpdate();
+    if (!m_kparams.enable_pipelined_update) {
+        m_taskgroup.run([=]() { update(dt); });
+        return;
+    }
+
+    // readers see m_front until endUpdate(). it is published again only if the world was changed since last update.
+    if (!m_front_valid) {
+        publishGeneration(m_front);
+    }
+    m_front.plane_colliders = m_plane_colliders;
+    m_front.sphere_colliders = m_sphere_colliders;
+    m_front.capsule_colliders = m_capsule_colliders;
+    m_front.box_colliders = m_box_colliders;
+    m_requested_kparams = m_kparams;
+    m_in_flight = true;
+    m_taskgroup.run([=]() {
+        update(dt);
+        publishGeneration(m_back);
+    });
 }
 
 void mpWorld::endUpdate()
 {
     m_taskgroup.wait();
+    if (!m_in_flight) { return; }
+
+    m_in_flight = false;
+    std::swap(m_front, m_back);
+    if (m_aos_owner == &m_back) { m_aos_owner = &m_front; }
+    m_front_valid = true;
+
+    std::vector<std::function<void()> > deferred;
+    deferred.swap(m_deferred);
+    for (auto &f : deferred) { f(); }
+}
+
+void mpWorld::publishGeneration(mpGeneration &g)
+{
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+    int num = m_num_particles;
+    g.kparams = m_kparams;
+    g.tparams = m_tparams;
+    g.timings = m_timings;
+    g.num_particles = num;
+    if (m_aos_owner == &g) {
+        // particles are there already
+    }
+    else if (m_num_soa == 0) {
+        reclaimAoS();
+        // hand the buffers over. all of them have max_particles elements, so swapping them never reallocates.
+        // m_imd is allocated by first update
+        m_imd.resize(m_particles.size());
+        g.particles.resize(m_particles.size());
+        g.imd.resize(m_particles.size());
+        g.particles.swap(m_particles);
+        g.imd.swap(m_imd);
+        m_aos_owner = &g;
+    }
+    else if (m_aos_valid) {
+        g.particles.resize(num);
+        g.imd.resize(num);
+        int num_imd = std::min<int>(num, (int)m_imd.size());
+        ist::parallel_for_blocked(0, num, g_particles_par_task,
+            [&](int begin, int end) {
+                std::copy(m_particles.begin() + begin, m_particles.begin() + end, g.particles.begin() + begin);
+                int end_imd = std::min<int>(end, num_imd);
+                if (begin < end_imd) {
+                    std::copy(m_imd.begin() + begin, m_imd.begin() + end_imd, g.imd.begin() + begin);
+                }
+            });
+    }
+    else {
+        g.particles.resize(num);
+        g.imd.resize(num);
+        eachSoASpan(
+            [&](const mpCell &span) {
+                mpAoSnizeFull(span, m_soa, g.particles.data(), g.imd.data());
+            });
+        std::copy(m_particles.begin() + m_num_soa, m_particles.begin() + num, g.particles.begin() + m_num_soa);
+        std::copy(m_imd.begin() + m_num_soa, m_imd.begin() + num, g.imd.begin() + m_num_soa);
+    }
+
+    // occupied cells in sorted order. key of a cell is the sort key of its first particle.
+    g.cells.resize(m_num_cells);
+    g.cell_keys.resize(m_num_cells);
+    ist::parallel_for(0, m_num_cells, g_particles_par_task,
+        [&](int i) {
+            const mpCell &cell = m_cells[m_occupied_cells[i]];
+            g.cell_keys[i] = m_sort_keys[cell.begin];
+            // particles may be removed since the cells were built
+            g.cells[i] = cell;
+            g.cells[i].begin = std::min<int>(cell.begin, num);
+            g.cells[i].end = std::min<int>(cell.end, num);
+        });
+}
+
+void mpWorld::updateAll(mpWorld **worlds, int num, float dt)
+{
+    std::vector<mpWorld*> sorted;
+    size_t total = 0;
+    for (int i = 0; i < num; ++i) {
+        if (worlds[i] == nullptr) { continue; }
+        // update() must not run on a world that is in flight. this also applies changes deferred during the flight.
+        worlds[i]->endUpdate();
+        sorted.push_back(worlds[i]);
+        total += worlds[i]->getNumParticles();
+    }
+    if (sorted.empty()) { return; }
+    // largest first, so small ones fill threads at the end
+    std::stable_sort(sorted.begin(), sorted.end(),
+        [](const mpWorld *a, const mpWorld *b) { return a->getNumParticles() > b->getNumParticles(); });
+
+    // worlds smaller than this aren't worth splitting. they are updated one by one in tasks of about this many particles.
+    int share = std::max<int>((int)(total / (ist::num_threads() * 2)), g_particles_par_task);
+
+    ist::task_group tasks;
+    size_t i = 0;
+    for (; i < sorted.size() && sorted[i]->getNumParticles() >= share; ++i) {
+        mpWorld *w = sorted[i];
+        tasks.run([w, dt]() { w->update(dt); });
+    }
+    while (i < sorted.size()) {
+        size_t beg = i;
+        int n = sorted[i++]->getNumParticles();
+        while (i < sorted.size() && n + sorted[i]->getNumParticles() <= share) {
+            n += sorted[i++]->getNumParticles();
+        }
+        size_t end = i;
+        tasks.run([&sorted, beg, end, dt]() {
+            ist::scoped_max_concurrency serial(1);
+            for (size_t wi = beg; wi < end; ++wi) { sorted[wi]->update(dt); }
+        });
+    }
+    tasks.wait();
 }
 
 
 void mpWorld::callHandlers()
 {
+    ist::scoped_max_concurrency limit(m_kparams.max_threads);
+    // while update is in flight, hits and colliders are taken from m_front
+    bool front = m_in_flight;
+    mpPlaneColliderCont &planes = front ? m_front.plane_colliders : m_plane_colliders;
+    mpSphereColliderCont &spheres = front ? m_front.sphere_colliders : m_sphere_colliders;
+    mpCapsuleColliderCont &capsules = front ? m_front.capsule_colliders : m_capsule_colliders;
+    mpBoxColliderCont &boxes = front ? m_front.box_colliders : m_box_colliders;
+    mpParticle *particles = front ? m_front.particles.data() : m_particles.data();
+    mpParticleIM *imd = front ? m_front.imd.data() : m_imd.data();
+    int num_particles = front ? m_front.num_particles : m_num_particles;
+
     int num_colliders = 0;
     // search max id and allocate properties
-    if (!m_plane_colliders.empty()) { num_colliders = std::max(num_colliders, m_plane_colliders.back().props.owner_id + 1); }
-    if (!m_sphere_colliders.empty()) { num_colliders = std::max(num_colliders, m_sphere_colliders.back().props.owner_id + 1); }
-    if (!m_capsule_colliders.empty()) { num_colliders = std::max(num_colliders, m_capsule_colliders.back().props.owner_id + 1); }
-    if (!m_box_colliders.empty()) { num_colliders = std::max(num_colliders, m_box_colliders.back().props.owner_id + 1); }
+    if (!planes.empty()) { num_colliders = std::max(num_colliders, planes.back().props.owner_id + 1); }
+    if (!spheres.empty()) { num_colliders = std::max(num_colliders, spheres.back().props.owner_id + 1); }
+    if (!capsules.empty()) { num_colliders = std::max(num_colliders, capsules.back().props.owner_id + 1); }
+    if (!boxes.empty()) { num_colliders = std::max(num_colliders, boxes.back().props.owner_id + 1); }
     m_collider_properties.resize(num_colliders);
 
-    for (auto &c : m_plane_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
-    for (auto &c : m_sphere_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
-    for (auto &c : m_capsule_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
-    for (auto &c : m_box_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
+    for (auto &c : planes) { m_collider_properties[c.props.owner_id] = &c.props; }
+    for (auto &c : spheres) { m_collider_properties[c.props.owner_id] = &c.props; }
+    for (auto &c : capsules) { m_collider_properties[c.props.owner_id] = &c.props; }
+    for (auto &c : boxes) { m_collider_properties[c.props.owner_id] = &c.props; }
 
     ist::parallel_invoke(
         [&]() {
@@ -890,29 +2745,39 @@ void mpWorld::callHandlers()
         }
     );
 
+    if (!front && (m_has_hithandler || m_has_forcehandler)) {
+        // may take particles back from m_front
+        validateAoS();
+        particles = m_particles.data();
+        imd = m_imd.data();
+    }
     if (m_has_hithandler) {
-        for (int i = 0; i < m_num_particles; ++i) {
-            mpParticle &p = m_particles[i];
+        if (!front) { m_front_valid = false; }
+        for (int i = 0; i < num_particles; ++i) {
+            mpParticle &p = particles[i];
             if (p.hit != 0) {
                 m_current = i;
                 mpHitHandler handler = (mpHitHandler)(m_collider_properties[p.hit]->hit_handler);
-                if (handler) { handler(&p); }
+                if (handler) {
+                    invokeHandler(handler, particles, i);
+                }
             }
         }
+        if (front) { flushEdits(); }
     }
     if (m_has_forcehandler) {
 
         m_pforce.resize(num_colliders);
         memset(m_pforce.data(), 0, sizeof(mpParticleForce)*m_pforce.size());
-        ist::parallel_for_blocked(0, m_num_particles, g_particles_par_task,
+        ist::parallel_for_blocked(0, num_particles, front ? g_particles_par_task : m_particles_par_task,
             [&](int begin, int end) {
                 mpPForceCont &pf = m_pcombinable.local();
                 pf.resize(num_colliders);
                 for (int i = begin; i != end; ++i) {
-                    mpParticle &p = m_particles[i];
+                    mpParticle &p = particles[i];
                     if (p.hit != 0) {
                         (simdvec4&)pf[p.hit].position += (simdvec4&)p.position;
-                        (simdvec4&)pf[p.hit].force += (simdvec4&)m_imd[i].accel;
+                        (simdvec4&)pf[p.hit].force += (simdvec4&)imd[i].accel;
                         ++pf[p.hit].num_hits;
                     }
                 }
@@ -941,25 +2806,33 @@ void mpWorld::callHandlers()
 
 
 
-inline vec2 mpComputeDataTextureCoord(int nth)
-{
-    static const float xd = 1.0f / mpDataTextureWidth;
-    static const float yd = 1.0f / mpDataTextureHeight;
-    int xi = (nth * 3) % mpDataTextureWidth;
-    int yi = (nth * 3) / mpDataTextureWidth;
-    return vec2(xd*xi + xd*0.5f, yd*yi + yd*0.5f);
-}
-
 int mpWorld::updateDataTexture(void *tex, int width, int height)
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
+    // latest snapshot update published. if there is no new one, last one is uploaded again.
+    m_snapshots.acquire();
+    const mpRenderSnapshot &snap = m_snapshots.front();
 
     auto *gd = gi::GetGraphicsInterface();
-    if (gd && !m_particles_gpu.empty()) {
-        int num_needs_copy = std::max<int>(m_num_particles_gpu, m_num_particles_gpu_prev);
-        m_num_particles_gpu_prev = m_num_particles_gpu;
-        gd->writeTexture2D(tex, width, height, gi::TextureFormat::RGBAf32,
-            m_particles_gpu.data(), sizeof(mpParticle)*m_kparams.max_particles);
+    if (gd && !snap.data.empty()) {
+        gi::TextureFormat format = mpGetDataTextureFormat(snap.layout);
+        size_t stride = mpGetRenderDataStride(snap.layout);
+        size_t pitch = size_t(width) * gi::GraphicsInterface::GetTexelSize(format);
+
+        // alive particles are packed at front. rows after the ones that had alive particles on last upload are
+        // already dead on the texture, so only rows covering alive and newly dead particles are written.
+        // new texture or layout has unknown contents. all rows snapshot has are written.
+        int num_needs_copy = std::max<int>(snap.num_particles, m_num_particles_gpu_prev);
+        if (tex != m_data_texture || snap.layout != m_data_texture_layout) {
+            num_needs_copy = int(snap.data.size() / stride);
+        }
+        int num_rows = (int)std::min<size_t>(std::min<size_t>(height, ceildiv(stride*num_needs_copy, pitch)), snap.data.size() / pitch);
+
+        if (num_rows > 0 && gd->writeTexture2DRows(tex, width, height, format, 0, num_rows, snap.data.data()) != gi::Result::OK) {
+            gd->writeTexture2D(tex, width, height, format, snap.data.data(), snap.data.size());
+        }
+        m_data_texture = tex;
+        m_data_texture_layout = snap.layout;
+        m_num_particles_gpu_prev = snap.num_particles;
     }
-    return m_num_particles_gpu;
+    return snap.num_particles;
 }
@@ -7,10 +7,17 @@ public:
 
     mpWorld();
     ~mpWorld();
+    // with enable_pipelined_update, readers (getParticles(), scans, callHandlers()) use the state this started from
+    // until endUpdate(), and changes made meanwhile are deferred to endUpdate(). changes handlers made to particles
+    // are applied to the new state by id.
     void beginUpdate(float dt);
     void endUpdate();
     void update(float dt);
     void callHandlers();
+    // update worlds at once with one wait. large worlds are split to all threads, small ones are packed into tasks.
+    // updates started by beginUpdate() are finished by endUpdate() first. pipelined worlds are updated immediately,
+    // so readers see the new state when this returns.
+    static void updateAll(mpWorld **worlds, int num, float dt);
 
     void addParticles(mpParticle *p, size_t num);
     void addPlaneColliders(mpPlaneCollider *col, size_t num);
@@ -36,10 +43,17 @@ public:
     void                    setKernelParams(const mpKernelParams &v);
     mpTempParams&           getTempParams();
     const mpCellCont&       getCells();
+    const mpPhaseTimings&   getPhaseTimings() const;
+    // index of getCells() for cell coordinate. -1 if sparse grid has no such cell. same as GetCellIndex() in mpCore.ispc.
+    int                     findCell(const ivec3 &ci) const;
 
     void        forceSetNumParticles(int v);
     int         getNumParticles() const;
     mpParticle* getParticles();
+    // same as getParticles() but caller must not modify particles. doesn't turn persistent SoA data back into AoS.
+    const mpParticle* getParticlesReadOnly();
+    // render thread: latest particles update published. acquired by updateDataTexture().
+    // getParticlesGPU() is null unless data_texture_layout is Full.
     int         getNumParticlesGPU() const;
     mpParticle* getParticlesGPU();
 
@@ -52,11 +66,85 @@ public:
 
 private:
     typedef ist::combinable<mpPForceCont> mpPForceConbinable;
+    typedef std::vector<std::pair<float, int> > mpAxisKeyCont;
+    typedef ist::combinable<mpAxisKeyCont> mpAxisKeyCombinable;
+
+    // persistent SoA mode: build AoS view of particles from SoA data if it is outdated
+    void validateAoS();
+    // pipelined update: take back m_particles and m_imd handed to m_aos_owner by publishGeneration(). m_front has to be published again.
+    void reclaimAoS();
+    // persistent SoA mode: write m_particles[i] modified by handler back to SoA data
+    void writeBackParticle(int i);
+    // call body(index of m_cells) for each occupied cell in parallel. tasks are split by estimated work of cells.
+    template<class Body> void eachOccupiedCell(const Body &body);
+    // call body(const mpCell&) for each aligned span of SoA data in parallel: occupied cells, or x-lines on row span mode.
+    template<class Body> void eachSoASpan(const Body &body);
+    // half shell mode: call body(index of m_cells) for each occupied cell. colors run one by one, cells of a color in parallel.
+    template<class Body> void eachColoredCell(const Body &body);
+    // call body(phase, index of m_cells) for each phase in [0, num_phases) and each occupied cell. phases of a cell run in order.
+    // tasks of eachOccupiedCell are the tiles. phase p of a tile starts once phase p-1 of the tiles around it is done.
+    template<class Body> void eachOccupiedCellPhased(int num_phases, const Body &body);
+    // builds dependencies of eachOccupiedCellPhased(). returns false if tiles around a tile can't be bounded (Morton ordering).
+    bool buildTileGraph(int num_phases);
+    // neighbor list mode: carry lists over to current particle order, and rebuild them if they may miss pairs.
+    // num_sorted is number of particles including dead ones, sorted this frame.
+    void updateNeighborLists(int num_sorted, bool needs_gather);
+    // call handler(particle) for particles of readers in [bl, ur]. overlap(cell_bl, cell_ur) returns 0: cell is outside,
+    // 1: test(position) decides, 2: all particles of cell.
+    template<class Overlap, class Test>
+    void scanCells(bool parallel, mpHitHandler handler, const vec3 &bl, const vec3 &ur, const Overlap &overlap, const Test &test);
+    // call handler for particle i of readers. changes are written back to SoA data, or recorded while update is in flight.
+    void invokeHandler(mpHitHandler handler, mpParticle *particles, int i);
+    // pipelined update: copy current state to g. AoS particles are handed over instead of copied when they are the master data.
+    void publishGeneration(mpGeneration &g);
+    // pipelined update: defer particles modified by handlers on m_front to endUpdate()
+    void flushEdits();
+    // pipelined update: apply changes of particles modified by handlers to particles with the same id
+    void applyEdits(mpParticleEditCont &edits);
 
     mpParticleCont          m_particles;
     mpParticleIMCont        m_imd;
+    mpParticleCont          m_particles_tmp;
+    mpParticleIMCont        m_imd_tmp;
+    mpUIntArray             m_sort_keys;
+    mpUIntArray             m_sort_keys_tmp;
+    mpUIntArray             m_sort_keys_prev;
+    mpIntArray              m_sort_indices;
+    mpIntArray              m_sort_indices_tmp;
+    mpIntArray              m_sort_block_offsets;
+    int                     m_num_sorted;
     mpSoAData               m_soa;
+    mpSoAData               m_soa_tmp;
+    mpIntArray              m_soa_slots;        // particle index -> SoA index
+    mpIntArray              m_soa_slots_tmp;
+    int                     m_num_soa;          // particles [0, m_num_soa) are held in m_soa
+    bool                    m_aos_valid;
     mpCellCont              m_cells;
+    int                     m_num_cells;        // number of occupied cells
+    mpIntArray              m_occupied_cells;   // indices of m_cells that have particles, in sorted order
+    mpIntArray              m_cell_task_offsets;// task i processes m_occupied_cells[offsets[i], offsets[i+1])
+    mpFloatArray            m_cell_weights;     // prefix sum of estimated work of occupied cells
+    mpInt8Array             m_cell_sort_axis;   // dense cells: axis particles of each cell are sorted along. -1 if not sorted.
+    mpIntArray              m_dense_cells;      // dense cells: indices of m_cells sorted this frame
+    mpAxisKeyCombinable     m_dense_keys;       // dense cells: per-thread work area of (position on sort axis, particle index)
+    bool                    m_sparse_cells;     // m_cells is laid out as sparse grid
+    bool                    m_soa_row_spans;    // SoA data is laid out for row span mode
+    int                     m_soa_block_size;   // SoA spans are padded and aligned to this many particles
+    mpCellCont              m_soa_lines;        // row span mode: x-lines of cells. soai is aligned.
+    mpIntArray              m_soa_line_cells;   // row span mode: line i has m_occupied_cells[m_soa_line_cells[i], m_soa_line_cells[i+1])
+    mpIntArray              m_colored_cells;    // half shell mode: m_occupied_cells grouped by color
+    mpIntArray              m_color_offsets;    // half shell mode: color i has m_colored_cells[m_color_offsets[i], m_color_offsets[i+1])
+    mpIntArray              m_color_task_offsets;
+    mpIntArray              m_tile_ranges;      // task graph: phase p of tile t waits for phase p-1 of tiles [ranges[t*2], ranges[t*2+1]]
+    mpIntArray              m_graph_preds;      // task graph: number of predecessors of node (phase * num tiles + tile)
+    mpIntArray              m_graph_succ_offsets;// task graph: successors of node i are m_graph_succs[offsets[i], offsets[i+1])
+    mpIntArray              m_graph_succs;
+    mpIntArray              m_tile_ranges_tmp;
+    int                     m_graph_phases;     // task graph: number of phases the graph above was built for
+    mpNeighborLists         m_nlists;
+    mpCellIndexCont         m_cell_coords;      // sparse grid: coordinate of each cell
+    mpUIntArray             m_cell_table_keys;  // sparse grid: cell key -> index of m_cells
+    mpIntArray              m_cell_table_values;
     u32                     m_id_seed;
     int                     m_num_particles;
 
@@ -73,13 +161,29 @@ private:
     std::mutex              m_mutex;
     mpKernelParams          m_kparams;
     mpTempParams            m_tparams;
+    mpPhaseTimings          m_timings;
+    int                     m_particles_par_task;   // grain of per-particle loops
+    int                     m_cell_tasks_par_thread;
+    mpGrainTuner            m_particles_tuner;
+    mpGrainTuner            m_cells_tuner;
 
     mpPForceCont            m_pforce;
     mpPForceConbinable      m_pcombinable;
 
-    int                     m_num_particles_gpu;
-    int                     m_num_particles_gpu_prev;
-    mpParticleCont          m_particles_gpu;
+    ist::triple_buffer<mpRenderSnapshot> m_snapshots; // update writes back(), render thread reads front()
+    int                     m_num_particles_gpu_prev;   // alive particles on data texture
+    void*                   m_data_texture;             // data texture that was written whole. others are written whole first.
+    int                     m_data_texture_layout;      // layout m_data_texture was written in
 
     int                     m_current;
+
+    bool                    m_in_flight;        // pipelined update is running. readers use m_front and changes are deferred.
+    bool                    m_front_valid;      // m_front matches particles. cleared when they are changed outside update.
+    mpGeneration            m_front;
+    mpGeneration            m_back;             // filled by pipelined update. swapped with m_front at endUpdate().
+    mpGeneration           *m_aos_owner;        // generation that holds particles & imd of the world. m_particles and m_imd are stale then.
+    mpKernelParams          m_requested_kparams;// params given while update is in flight. getKernelParams() returns these.
+    std::vector<std::function<void()> > m_deferred;
+    mpParticleEditCont      m_edits;            // particles modified by handlers on m_front, not yet deferred
+    std::mutex              m_edits_mutex;
 };
@@ -7,6 +7,7 @@
 #include <functional>
 #include <random>
 #include <mutex>
+#include <chrono>
 
 #define GLM_FORCE_RADIANS
 #ifdef _WIN64
@@ -16,12 +17,15 @@
 #include <glm/gtx/simd_vec4.hpp>
 #include <glm/gtx/simd_mat4.hpp>
 
-#if defined(_WIN32) && !defined(mpWithTBB)
+#ifdef _WIN32
     #include <Windows.h>
-    #include <ppl.h>
-#else
+#endif
+// same backend selection as mpConcurrency.h: ist::ws unless mpWithTBB is defined, PPL on Windows.
+#if defined(mpWithTBB) && !defined(mpWithWorkStealing)
     #include <tbb/tbb.h>
     #include <tbb/combinable.h>
+#elif defined(_WIN32) && !defined(mpWithWorkStealing)
+    #include <ppl.h>
 #endif
 
 #ifdef max
@@ -88,6 +88,7 @@ void TestImpl::testMain()
     case TestType::D3D12: ifs = gi::CreateGraphicsInterface(gi::DeviceType::D3D12, getDevice()); break;
     case TestType::OpenGL: ifs = gi::CreateGraphicsInterface(gi::DeviceType::OpenGL, getDevice()); break;
     case TestType::Vulkan: ifs = gi::CreateGraphicsInterface(gi::DeviceType::Vulkan, getDevice()); break;
+    case TestType::Null: ifs = gi::CreateGraphicsInterface(gi::DeviceType::Null, getDevice()); break;
     }
     if (!ifs) {
         printf("TestImpl::testMain(): interface is null\n");
@@ -294,6 +295,7 @@ void RunTest(TestType type)
     case TestType::D3D12: test = CreateTestD3D12(); break;
     case TestType::OpenGL: test = CreateTestOpenGL(); break;
     case TestType::Vulkan: test = CreateTestVulkan(); break;
+    case TestType::Null: test = CreateTestNull(); break;
     }
 
     if (!test) {
@@ -355,6 +357,7 @@ int main(int argc, char *argv[])
         "2: D3D12:\n"
         "3: OpenGL:\n"
         "4: Vulkan:\n"
+        "5: Null:\n"
     );
 
     int type;
@@ -13,6 +13,7 @@ enum class TestType
     D3D12,
     OpenGL,
     Vulkan,
+    Null,
 };
 
 class TestImpl
@@ -31,3 +32,4 @@ TestImpl* CreateTestD3D11();
 TestImpl* CreateTestD3D12();
 TestImpl* CreateTestOpenGL();
 TestImpl* CreateTestVulkan();
+TestImpl* CreateTestNull();
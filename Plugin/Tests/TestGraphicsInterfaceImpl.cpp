@@ -414,3 +414,16 @@ TestImpl* CreateTestVulkan() { return new TestImplVulkan(); }
 #else // WithVulkan
 TestImpl* CreateTestVulkan() { return nullptr; }
 #endif // WithVulkan
+
+
+
+// null device needs nothing. window is only to run tests the same way as others.
+class TestImplNull : public TestImpl
+{
+public:
+    TestType getType() const override { return TestType::Null; }
+    void* getDevice() const override { return nullptr; }
+    void onInit(void *hwnd) override {}
+};
+
+TestImpl* CreateTestNull() { return new TestImplNull(); }
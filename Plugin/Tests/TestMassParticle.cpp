@@ -1,8 +1,739 @@
+#define NOMINMAX
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <random>
 #include "../MassParticle/MassParticle.h"
+#include "../MassParticle/mpConcurrency.h"
+#include "../GraphicsInterface/GraphicsInterface.h"
 
 
+static const float g_dt = 1.0f / 60.0f;
+
+static void ScatterBox(int ctx, mpV3 center, mpV3 size, int num)
+{
+    mpSpawnParams sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.lifetime = 1000.0f;
+    mpScatterParticlesBox(ctx, &center, &size, num, &sp);
+}
+
+// context with num_particles particles in a box. setup changes kernel params from defaults.
+static int CreateBenchContext(int num_particles, const std::function<void(mpKernelParams&)> &setup,
+    mpV3 center = mpV3(0.0f, 0.0f, 0.0f), mpV3 size = mpV3(5.0f, 5.0f, 5.0f))
+{
+    int ctx = mpCreateContext();
+    mpKernelParams kp;
+    mpGetKernelParams(ctx, &kp);
+    kp.max_particles = num_particles;
+    setup(kp);
+    mpSetKernelParams(ctx, &kp);
+    ScatterBox(ctx, center, size, num_particles);
+    return ctx;
+}
+
+// calls f once to warm up, then num times. returns ms of each call.
+static double MeasureEach(int num, const std::function<void()> &f)
+{
+    f();
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num; ++i) { f(); }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - begin).count() / num;
+}
+
+// updates once to warm up, then num_frames times. returns sum of phase timings of them. worst: longest total.
+static mpPhaseTimings SumPhaseTimings(int ctx, int num_frames, float *worst = nullptr)
+{
+    mpUpdate(ctx, g_dt);
+    mpPhaseTimings sum;
+    memset(&sum, 0, sizeof(sum));
+    if (worst) { *worst = 0.0f; }
+    for (int i = 0; i < num_frames; ++i) {
+        mpUpdate(ctx, g_dt);
+        mpPhaseTimings t;
+        mpGetPhaseTimings(ctx, &t);
+        sum.sort += t.sort; sum.cells += t.cells; sum.soa += t.soa; sum.neighbor_lists += t.neighbor_lists;
+        sum.kernels += t.kernels; sum.aos += t.aos; sum.gpu_copy += t.gpu_copy; sum.total += t.total;
+        if (worst) { *worst = std::max<float>(*worst, t.total); }
+    }
+    return sum;
+}
+
+
+// frame time and memory locality of neighbor cells for each cell ordering.
+// locality: distance in sorted particle array from first particle of each occupied cell to
+// first particles of its occupied neighbor cells. smaller distance = neighbor loops touch fewer cache lines.
+static void BenchCellOrdering(int num_particles, int num_frames)
+{
+    const char *names[] = { "Linear", "Morton" };
+    for (int ordering = 0; ordering < 2; ++ordering) {
+        int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+            kp.cell_ordering = (mpCellOrdering)ordering;
+        });
+        double ms = MeasureEach(num_frames, [&]() { mpUpdate(ctx, g_dt); });
+
+        mpKernelParams kp;
+        mpGetKernelParams(ctx, &kp);
+        const mpParticle *particles = mpGetParticlesReadOnly(ctx);
+        int n = mpGetNumParticles(ctx);
+        float cell_size[3] = {
+            kp.world_extent.x * 2.0f / kp.world_div.x,
+            kp.world_extent.y * 2.0f / kp.world_div.y,
+            kp.world_extent.z * 2.0f / kp.world_div.z,
+        };
+        auto cell_of = [&](int x, int y, int z) { return (int64_t(x) << 42) | (int64_t(y) << 21) | int64_t(z); };
+        auto coord_of = [&](const mpParticle &p, int *c) {
+            c[0] = (int)std::floor((p.position.x - kp.world_center.x + kp.world_extent.x) / cell_size[0]);
+            c[1] = (int)std::floor((p.position.y - kp.world_center.y + kp.world_extent.y) / cell_size[1]);
+            c[2] = (int)std::floor((p.position.z - kp.world_center.z + kp.world_extent.z) / cell_size[2]);
+        };
+        std::unordered_map<int64_t, int> first;
+        for (int i = 0; i < n; ++i) {
+            int c[3];
+            coord_of(particles[i], c);
+            first.insert(std::make_pair(cell_of(c[0], c[1], c[2]), i));
+        }
+
+        double total_distance = 0.0;
+        size_t num_pairs = 0, num_near = 0;
+        for (int i = 0; i < n; ++i) {
+            int c[3];
+            coord_of(particles[i], c);
+            auto self = first.find(cell_of(c[0], c[1], c[2]));
+            if (self->second != i) { continue; }
+            for (int y = -1; y <= 1; ++y) {
+                for (int z = -1; z <= 1; ++z) {
+                    for (int x = -1; x <= 1; ++x) {
+                        auto neighbor = first.find(cell_of(c[0] + x, c[1] + y, c[2] + z));
+                        if (neighbor == first.end() || neighbor == self) { continue; }
+                        int d = std::abs(neighbor->second - i);
+                        total_distance += d;
+                        ++num_pairs;
+                        if (d * sizeof(float) <= 4096) { ++num_near; } // same page of a SoA stream
+                    }
+                }
+            }
+        }
+        printf("%s: %.2f ms/frame, mean distance to neighbor cells: %.0f particles, within 4KB: %.1f%%\n",
+            names[ordering], ms,
+            num_pairs ? total_distance / num_pairs : 0.0,
+            num_pairs ? 100.0 * num_near / num_pairs : 0.0);
+        mpDestroyContext(ctx);
+    }
+}
+
+// frame time of interaction kernel variants: vectorized across neighbors, across own particles of each cell,
+// and picked per cell by occupancy (default). particle_size changes cell occupancy.
+static void BenchKernelVariants(int num_particles, int num_frames, float particle_size)
+{
+    const char *solver_names[] = { "Impulse", "SPH" };
+    const mpSolverType solvers[] = { mpSolverType::Impulse, mpSolverType::SPH };
+    const char *variant_names[] = { "by neighbor", "by particle", "by occupancy" };
+    const int thresholds[] = { -1, 1, 0 };
+    for (int si = 0; si < 2; ++si) {
+        for (int vi = 0; vi < 3; ++vi) {
+            int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+                kp.solver_type = solvers[si];
+                kp.particle_size = particle_size;
+                kp.particle_parallel_threshold = thresholds[vi];
+            });
+            double ms = MeasureEach(num_frames, [&]() { mpUpdate(ctx, g_dt); });
+
+            // mean number of particles in occupied cells
+            mpKernelParams kp;
+            mpGetKernelParams(ctx, &kp);
+            const mpParticle *particles = mpGetParticlesReadOnly(ctx);
+            int n = mpGetNumParticles(ctx);
+            std::unordered_map<int64_t, int> cells;
+            for (int i = 0; i < n; ++i) {
+                int c[3] = {
+                    (int)std::floor((particles[i].position.x - kp.world_center.x + kp.world_extent.x) * kp.world_div.x / (kp.world_extent.x * 2.0f)),
+                    (int)std::floor((particles[i].position.y - kp.world_center.y + kp.world_extent.y) * kp.world_div.y / (kp.world_extent.y * 2.0f)),
+                    (int)std::floor((particles[i].position.z - kp.world_center.z + kp.world_extent.z) * kp.world_div.z / (kp.world_extent.z * 2.0f)),
+                };
+                ++cells[(int64_t(c[0]) << 42) | (int64_t(c[1]) << 21) | int64_t(c[2])];
+            }
+            printf("%s, %s: %.2f ms/frame, %.1f particles per occupied cell\n",
+                solver_names[si], variant_names[vi], ms, cells.empty() ? 0.0 : double(n) / cells.size());
+            mpDestroyContext(ctx);
+        }
+    }
+}
+
+// frame time of impulse solver with two sweeps (interaction, then integration) and one fused sweep.
+static void BenchFusedUpdate(int num_particles, int num_frames)
+{
+    const char *names[] = { "two sweeps", "fused" };
+    for (int fused = 0; fused < 2; ++fused) {
+        int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+            kp.enable_fused_update = fused;
+        });
+        double ms = MeasureEach(num_frames, [&]() { mpUpdate(ctx, g_dt); });
+        printf("%s: %.2f ms/frame\n", names[fused], ms);
+        mpDestroyContext(ctx);
+    }
+}
+
+// frame time of multi-pass solvers with a barrier between passes and with the tile graph, and time of each phase.
+static void BenchTaskGraph(int num_particles, int num_frames)
+{
+    const char *solver_names[] = { "Impulse (two sweeps)", "SPH", "SPHEst" };
+    const mpSolverType solvers[] = { mpSolverType::Impulse, mpSolverType::SPH, mpSolverType::SPHEst };
+    const char *names[] = { "barriers", "task graph" };
+    for (int si = 0; si < 3; ++si) {
+        for (int graph = 0; graph < 2; ++graph) {
+            int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+                kp.solver_type = solvers[si];
+                kp.enable_fused_update = 0;
+                kp.enable_task_graph = graph;
+            });
+            mpPhaseTimings sum = SumPhaseTimings(ctx, num_frames);
+            float n = (float)num_frames;
+            printf("%s, %s: %.2f ms/frame (sort %.2f, cells %.2f, soa %.2f, kernels %.2f, aos %.2f, gpu copy %.2f)\n",
+                solver_names[si], names[graph], sum.total / n,
+                sum.sort / n, sum.cells / n, sum.soa / n, sum.kernels / n, sum.aos / n, sum.gpu_copy / n);
+            mpDestroyContext(ctx);
+        }
+    }
+}
+
+// primitives of built-in work stealing scheduler (ist::ws) and the backend this build selected (TBB or PPL, see mpConcurrency.h).
+// fine grained parallel_for, parallel_sort, many small task_group tasks and nested parallel_for.
+static void BenchScheduler(int num_elements, int num_iterations)
+{
+    std::vector<float> data(num_elements);
+    std::vector<uint32_t> keys(num_elements), work(num_elements);
+    std::mt19937 rng(0);
+    for (auto &k : keys) { k = rng(); }
+
+    auto measure = [&](const std::function<void()> &f) { return MeasureEach(num_iterations, f); };
+    auto print = [&](const char *name, double backend, double ws) {
+        printf("%s: %s %.3f ms, work stealing %.3f ms\n", name, ist::backend_name(), backend, ws);
+    };
+
+    auto for_body = [&](int i) { data[i] = std::sqrt(float(i)) * 0.5f + data[i] * 0.5f; };
+    print("parallel_for (grain 256)",
+        measure([&]() { ist::parallel_for(0, num_elements, 256, for_body); }),
+        measure([&]() { ist::ws::parallel_for(0, num_elements, 256, for_body); }));
+    print("parallel_for (auto grain)",
+        measure([&]() { ist::parallel_for(0, num_elements, for_body); }),
+        measure([&]() { ist::ws::parallel_for(0, num_elements, for_body); }));
+
+    print("parallel_sort",
+        measure([&]() { work = keys; ist::parallel_sort(work.begin(), work.end()); }),
+        measure([&]() { work = keys; ist::ws::parallel_sort(work.begin(), work.end()); }));
+
+    const int num_tasks = 10000;
+    std::atomic<int> counter(0);
+    auto small_task = [&]() { counter.fetch_add(1, std::memory_order_relaxed); };
+    print("task_group (10000 tasks)",
+        measure([&]() { ist::task_group g; for (int i = 0; i < num_tasks; ++i) { g.run(small_task); } g.wait(); }),
+        measure([&]() { ist::ws::task_group g; for (int i = 0; i < num_tasks; ++i) { g.run(small_task); } g.wait(); }));
+
+    const int num_outer = 64;
+    int inner = num_elements / num_outer;
+    print("nested parallel_for",
+        measure([&]() {
+            ist::parallel_for(0, num_outer, [&](int o) {
+                ist::parallel_for(o * inner, (o + 1) * inner, 256, for_body);
+            });
+        }),
+        measure([&]() {
+            ist::ws::parallel_for(0, num_outer, [&](int o) {
+                ist::ws::parallel_for(o * inner, (o + 1) * inner, 256, for_body);
+            });
+        }));
+}
+
+// frame time of uniform and crowded scenes with fixed and tuned grain sizes.
+// on the crowded scene most particles are in a few cells, like the base of a fountain.
+static void BenchLoadBalance(int num_particles, int num_frames)
+{
+    const char *scene_names[] = { "uniform", "crowded" };
+    const char *names[] = { "fixed grain", "tuned grain" };
+    for (int scene = 0; scene < 2; ++scene) {
+        for (int tuning = 0; tuning < 2; ++tuning) {
+            auto setup = [&](mpKernelParams &kp) {
+                kp.max_particles = num_particles;
+                kp.enable_grain_tuning = tuning;
+            };
+            int ctx;
+            if (scene == 0) {
+                ctx = CreateBenchContext(num_particles, setup);
+            }
+            else {
+                int num_crowd = num_particles * 9 / 10;
+                ctx = CreateBenchContext(num_crowd, setup, mpV3(0.0f, 0.0f, 0.0f), mpV3(0.2f, 0.2f, 0.2f));
+                ScatterBox(ctx, mpV3(0.0f, 0.0f, 0.0f), mpV3(5.0f, 5.0f, 5.0f), num_particles - num_crowd);
+            }
+            // first frames of tuned grain try each candidate
+            for (int i = 0; i < 60; ++i) { mpUpdate(ctx, g_dt); }
+
+            mpPhaseTimings sum = SumPhaseTimings(ctx, num_frames);
+            printf("%s, %s: %.2f ms/frame (kernels %.2f)\n", scene_names[scene], names[tuning],
+                sum.total / num_frames, sum.kernels / num_frames);
+            mpDestroyContext(ctx);
+        }
+    }
+}
+
+// frame time of many worlds of mixed sizes: mpUpdate one by one, mpBeginUpdate/mpEndUpdate each, and mpUpdateAll.
+static void BenchUpdateAll(int num_worlds, int num_particles, int num_frames)
+{
+    const char *names[] = { "mpUpdate each", "mpBeginUpdate each", "mpUpdateAll" };
+    for (int mode = 0; mode < 3; ++mode) {
+        // world i has particles in proportion to i+1
+        std::vector<int> contexts(num_worlds);
+        int weight_total = num_worlds * (num_worlds + 1) / 2;
+        for (int i = 0; i < num_worlds; ++i) {
+            int n = std::max<int>(num_particles * (i + 1) / weight_total, 1);
+            contexts[i] = CreateBenchContext(n, [](mpKernelParams&) {});
+        }
+
+        auto update = [&]() {
+            switch (mode) {
+            case 0:
+                for (int ctx : contexts) { mpUpdate(ctx, g_dt); }
+                break;
+            case 1:
+                for (int ctx : contexts) { mpBeginUpdate(ctx, g_dt); }
+                for (int ctx : contexts) { mpEndUpdate(ctx); }
+                break;
+            case 2:
+                mpUpdateAll(contexts.data(), num_worlds, g_dt);
+                break;
+            }
+        };
+        printf("%d worlds, %s: %.2f ms/frame\n", num_worlds, names[mode], MeasureEach(num_frames, update));
+        for (int ctx : contexts) { mpDestroyContext(ctx); }
+    }
+}
+
+// average and worst frame time of particles piled up in a few cells, with and without dense cell handling.
+// particles are spread along x beyond the world and mpGenHash() clamps them into the edge cells.
+static void BenchDenseCells(int num_particles, int num_frames)
+{
+    const char *names[] = { "dense cells off", "dense cells on" };
+    for (int mode = 0; mode < 2; ++mode) {
+        int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+            kp.dense_cell_threshold = mode == 0 ? 0 : 256;
+            kp.world_extent = mpV3(2.56f, 2.56f, 2.56f);
+            kp.world_div = mpV3i(32, 32, 32);
+            kp.active_region_extent = mpV3(10.0f, 10.0f, 10.0f);
+        }, mpV3(5.0f, 0.0f, 0.0f), mpV3(2.0f, 0.3f, 0.3f));
+
+        float worst;
+        mpPhaseTimings sum = SumPhaseTimings(ctx, num_frames, &worst);
+        printf("%s: %.2f ms/frame (worst %.2f)\n", names[mode], sum.total / num_frames, worst);
+        mpDestroyContext(ctx);
+    }
+}
+
+
+static int g_pipelined_hits;
+static float g_pipelined_sum;
+
+// frame time of update plus main thread work that reads particles and scans them.
+// without pipelining the work waits for update. with it the work reads last frame while update runs.
+static void BenchPipelined(int num_particles, int num_frames)
+{
+    const char *names[] = { "mpUpdate then work", "pipelined" };
+    for (int mode = 0; mode < 2; ++mode) {
+        int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+            kp.enable_pipelined_update = mode;
+        });
+
+        auto work = [&]() {
+            const mpParticle *particles = mpGetParticlesReadOnly(ctx);
+            int num = mpGetNumParticles(ctx);
+            for (int i = 0; i < num; ++i) { g_pipelined_sum += particles[i].position.y; }
+            for (int i = 0; i < 16; ++i) {
+                mpV3 pos(float(i % 4) - 1.5f, 0.0f, float(i / 4) - 1.5f);
+                // captureless lambda converts to the calling convention of mpHitHandler
+                mpScanSphere(ctx, [](mpParticle*) { ++g_pipelined_hits; }, &pos, 0.5f);
+            }
+        };
+        auto frame = [&]() {
+            if (mode == 0) {
+                mpUpdate(ctx, g_dt);
+                work();
+            }
+            else {
+                mpBeginUpdate(ctx, g_dt);
+                work();
+                mpEndUpdate(ctx);
+            }
+        };
+        g_pipelined_hits = 0;
+        double ms = MeasureEach(num_frames, frame); // num_frames + 1 frames with warm up
+        printf("%s: %.2f ms/frame (%d hits/frame)\n", names[mode], ms, g_pipelined_hits / (num_frames + 1));
+        mpDestroyContext(ctx);
+    }
+}
+
+// time of building render data in each data texture layout, and bytes it uploads each frame.
+static void BenchDataLayouts(int num_particles, int num_frames)
+{
+    const char *names[] = { "Full", "Half", "Position", "PositionHalf" };
+    const int bytes_each_particle[] = { 48, 16, 16, 8 };
+    for (int soa = 0; soa < 2; ++soa) {
+        for (int layout = 0; layout < 4; ++layout) {
+            int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+                kp.enable_persistent_soa = soa;
+                kp.data_texture_layout = (mpDataTextureLayout)layout;
+            });
+            mpPhaseTimings sum = SumPhaseTimings(ctx, num_frames);
+            printf("%s%s: %.3f ms/frame, %.2f MB/frame\n", names[layout], soa ? " (persistent SoA)" : "",
+                sum.gpu_copy / num_frames, double(bytes_each_particle[layout]) * mpGetNumParticles(ctx) / (1024.0 * 1024.0));
+            mpDestroyContext(ctx);
+        }
+    }
+}
+
+// data texture uploads of each layout through null graphics device. no GPU is needed.
+// bandwidth: simulated bus in GB/s. 0: uploads are plain copies.
+static void BenchUpload(int num_particles, int num_frames, double bandwidth)
+{
+    static gi::NullDeviceStats s_stats;
+    gi::NullDeviceConfig conf;
+    conf.bandwidth = bandwidth * 1024.0 * 1024.0 * 1024.0;
+    conf.stats = &s_stats;
+    mpSetGraphicsInterface(mpGraphicsInterfaceType::Null, &conf);
+
+    const char *names[] = { "Full", "Half", "Position", "PositionHalf" };
+    const int texels_each_particle[] = { 3, 2, 1, 1 };
+    const int tex_width = 3072;
+    int textures[4]; // only addresses are used. null device gives them host memory.
+    for (int layout = 0; layout < 4; ++layout) {
+        int ctx = CreateBenchContext(num_particles, [&](mpKernelParams &kp) {
+            kp.data_texture_layout = (mpDataTextureLayout)layout;
+        });
+
+        // first upload writes whole texture
+        int tex_height = (num_particles * texels_each_particle[layout] + tex_width - 1) / tex_width;
+        mpUpdate(ctx, g_dt);
+        mpUpdateDataTexture(ctx, &textures[layout], tex_width, tex_height);
+        s_stats = gi::NullDeviceStats();
+
+        for (int i = 0; i < num_frames; ++i) {
+            mpUpdate(ctx, g_dt);
+            mpUpdateDataTexture(ctx, &textures[layout], tex_width, tex_height);
+        }
+        printf("%s: %.2f MB/frame (%.2f MB staged), %d writes/frame, %.3f ms/frame (worst %.3f)\n", names[layout],
+            double(s_stats.bytes_written) / num_frames / (1024.0 * 1024.0),
+            double(s_stats.bytes_staged) / num_frames / (1024.0 * 1024.0),
+            s_stats.num_texture_writes / num_frames, s_stats.write_time / num_frames, s_stats.max_write_time);
+        mpDestroyContext(ctx);
+    }
+}
+
+// particles of equivalence tests. ids are far above ids that contexts give to added particles.
+static std::vector<mpParticle> MakeTestParticles(int num, float half_size)
+{
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> pos(-half_size, half_size), vel(-1.0f, 1.0f);
+    std::vector<mpParticle> particles(num);
+    for (int i = 0; i < num; ++i) {
+        mpParticle &p = particles[i];
+        float x = pos(rng), y = pos(rng), z = pos(rng);
+        float vx = vel(rng), vy = vel(rng), vz = vel(rng);
+        p.position = mpV3(x, y, z);
+        p.velocity = mpV3(vx, vy, vz);
+        p.id = 1000000 + i;
+        p.lifetime = 1000.0f;
+    }
+    return particles;
+}
+
+static int CreateTestContext(const std::vector<mpParticle> &particles, const std::function<void(mpKernelParams&)> &setup)
+{
+    int ctx = mpCreateContext();
+    mpKernelParams kp;
+    mpGetKernelParams(ctx, &kp);
+    kp.max_particles = (int)particles.size() * 2; // room for particles tests add
+    setup(kp);
+    mpSetKernelParams(ctx, &kp);
+    mpForceSetNumParticles(ctx, (int)particles.size());
+    memcpy(mpGetParticles(ctx), particles.data(), sizeof(mpParticle) * particles.size());
+    return ctx;
+}
+
+// compares particles of ctx with particles of ctx_ref that have same id. positions and velocities may differ by tolerance.
+static bool CompareParticles(const char *name, int ctx_ref, int ctx, float tolerance)
+{
+    int num_ref = mpGetNumParticles(ctx_ref);
+    int num = mpGetNumParticles(ctx);
+    const mpParticle *ref = mpGetParticlesReadOnly(ctx_ref);
+    const mpParticle *particles = mpGetParticlesReadOnly(ctx);
+    std::unordered_map<uint32_t, const mpParticle*> by_id;
+    for (int i = 0; i < num_ref; ++i) { by_id[ref[i].id] = &ref[i]; }
+
+    int num_missing = 0, num_off = 0;
+    float max_error = 0.0f;
+    for (int i = 0; i < num; ++i) {
+        auto it = by_id.find(particles[i].id);
+        if (it == by_id.end()) { ++num_missing; continue; }
+        const mpParticle &a = *it->second, &b = particles[i];
+        float errors[] = {
+            a.position.x - b.position.x, a.position.y - b.position.y, a.position.z - b.position.z,
+            a.velocity.x - b.velocity.x, a.velocity.y - b.velocity.y, a.velocity.z - b.velocity.z,
+        };
+        float error = 0.0f;
+        for (float e : errors) { error = std::max<float>(error, std::abs(e)); }
+        // NaN is never within tolerance
+        if (!(error <= tolerance)) { ++num_off; }
+        max_error = std::max<float>(max_error, error);
+    }
+    bool ok = num == num_ref && num_missing == 0 && num_off == 0;
+    printf("%s: %s (%d/%d particles, %d missing, %d off, max error %g)\n",
+        name, ok ? "OK" : "FAILED", num, num_ref, num_missing, num_off, max_error);
+    return ok;
+}
+
+// runs num_frames updates of same particles with default params and with each optional mode, and compares results.
+// modes that reorder floating point sums get a larger tolerance. differences of them grow each frame, so frames are few.
+static bool TestEquivalence(int num_particles, int num_frames)
+{
+    struct Case
+    {
+        const char *name;
+        float tolerance;
+        std::function<void(mpKernelParams&)> base; // both contexts
+        std::function<void(mpKernelParams&)> mode; // tested context
+    };
+    auto impulse = [](mpKernelParams&) {};
+    auto sph = [](mpKernelParams &kp) { kp.solver_type = mpSolverType::SPH; };
+    auto sph_est = [](mpKernelParams &kp) { kp.solver_type = mpSolverType::SPHEst; };
+    // list kernel and dense cell windows limit advection to interaction range, stencil kernels don't
+    auto no_advection = [](mpKernelParams &kp) { kp.advection = 0.0f; };
+    // modes that keep the order of every sum give the same result. allow a few ulps for contracted multiply-adds.
+    // modes that reorder sums drift apart each frame, SPH pressure faster than impulse.
+    // missing or extra neighbors are off by far more than these.
+    const float same_order = 1e-6f;
+    const float reordered = 1e-4f;
+    const float reordered_sph = 1e-3f;
+    const Case cases[] = {
+        { "fused update", same_order, impulse, [](mpKernelParams &kp) { kp.enable_fused_update = 1; } },
+        { "half shell", reordered, impulse, [](mpKernelParams &kp) { kp.enable_half_shell = 1; } },
+        { "half shell (SPH)", reordered_sph, sph, [](mpKernelParams &kp) { kp.enable_half_shell = 1; } },
+        { "sparse grid", same_order, impulse, [](mpKernelParams &kp) { kp.enable_sparse_grid = 1; } },
+        { "sparse grid (SPHEst)", same_order, sph_est, [](mpKernelParams &kp) { kp.enable_sparse_grid = 1; } },
+        // same cells as default world, but 8 cells wide. particles of distant cells share keys.
+        { "sparse grid (aliased)", reordered, impulse, [](mpKernelParams &kp) {
+            kp.enable_sparse_grid = 1;
+            kp.world_extent = mpV3(0.64f, 0.64f, 0.64f);
+            kp.world_div = mpV3i(8, 8, 8);
+        } },
+        { "incremental sort", same_order, impulse, [](mpKernelParams &kp) { kp.enable_incremental_sort = 1; } },
+        { "persistent SoA", same_order, impulse, [](mpKernelParams &kp) { kp.enable_persistent_soa = 1; } },
+        { "Morton ordering", reordered, impulse, [](mpKernelParams &kp) { kp.cell_ordering = mpCellOrdering::Morton; } },
+        { "row spans", reordered, impulse, [](mpKernelParams &kp) { kp.enable_row_spans = 1; } },
+        { "by neighbor", reordered, impulse, [](mpKernelParams &kp) { kp.particle_parallel_threshold = -1; } },
+        { "by particle", reordered, impulse, [](mpKernelParams &kp) { kp.particle_parallel_threshold = 1; } },
+        { "by particle (SPH)", reordered_sph, sph, [](mpKernelParams &kp) { kp.particle_parallel_threshold = 1; } },
+        { "SoA blocks of 16", same_order, impulse, [](mpKernelParams &kp) { kp.soa_block_size = 16; } },
+        { "single thread", same_order, impulse, [](mpKernelParams &kp) { kp.max_threads = 1; } },
+        { "task graph", same_order, impulse, [](mpKernelParams &kp) { kp.enable_task_graph = 1; } },
+        { "task graph (SPH)", same_order, sph, [](mpKernelParams &kp) { kp.enable_task_graph = 1; } },
+        { "task graph (SPHEst)", same_order, sph_est, [](mpKernelParams &kp) { kp.enable_task_graph = 1; } },
+        // impulse solver with advection keeps stencil kernels
+        { "neighbor lists", same_order, impulse, [](mpKernelParams &kp) { kp.enable_neighbor_lists = 1; } },
+        { "neighbor lists (no advection)", reordered, no_advection, [](mpKernelParams &kp) { kp.enable_neighbor_lists = 1; } },
+        { "neighbor lists (SPH)", reordered_sph, sph, [](mpKernelParams &kp) { kp.enable_neighbor_lists = 1; } },
+        // impulse solver with advection doesn't sort dense cells. without it and on SPH, sorting reorders sums.
+        { "dense cells", same_order, impulse, [](mpKernelParams &kp) { kp.dense_cell_threshold = 4; } },
+        { "dense cells (no advection)", reordered, no_advection, [](mpKernelParams &kp) { kp.dense_cell_threshold = 4; } },
+        { "dense cells (SPH)", reordered_sph, sph, [](mpKernelParams &kp) { kp.dense_cell_threshold = 4; } },
+    };
+
+    auto particles = MakeTestParticles(num_particles, 1.0f);
+    bool ok = true;
+    for (auto &c : cases) {
+        int ref = CreateTestContext(particles, c.base);
+        int ctx = CreateTestContext(particles, [&](mpKernelParams &kp) { c.base(kp); c.mode(kp); });
+        for (int i = 0; i < num_frames; ++i) {
+            mpUpdate(ref, g_dt);
+            mpUpdate(ctx, g_dt);
+        }
+        ok = CompareParticles(c.name, ref, ctx, c.tolerance) && ok;
+        mpDestroyContext(ctx);
+        mpDestroyContext(ref);
+    }
+    return ok;
+}
+
+// changes made while a pipelined update is in flight are deferred to mpEndUpdate().
+// results must be same as making them after mpUpdate().
+// mpUpdateAll() shares threads among contexts, but each context must end up as if updated alone.
+static bool TestUpdateAll(int num_particles, int num_frames)
+{
+    std::function<void(mpKernelParams&)> setups[] = {
+        [](mpKernelParams&) {},
+        [](mpKernelParams &kp) { kp.solver_type = mpSolverType::SPH; kp.enable_task_graph = 1; },
+        [](mpKernelParams &kp) { kp.max_threads = 2; },
+        [](mpKernelParams &kp) { kp.enable_persistent_soa = 1; kp.enable_incremental_sort = 1; },
+    };
+    const int num_contexts = sizeof(setups) / sizeof(setups[0]);
+
+    std::vector<int> refs, contexts;
+    for (int i = 0; i < num_contexts; ++i) {
+        auto particles = MakeTestParticles(num_particles >> i, 1.0f);
+        refs.push_back(CreateTestContext(particles, setups[i]));
+        contexts.push_back(CreateTestContext(particles, setups[i]));
+    }
+    for (int i = 0; i < num_frames; ++i) {
+        for (int ref : refs) { mpUpdate(ref, g_dt); }
+        mpUpdateAll(contexts.data(), num_contexts, g_dt);
+    }
+    bool ok = true;
+    for (int i = 0; i < num_contexts; ++i) {
+        ok = CompareParticles("update all", refs[i], contexts[i], 1e-6f) && ok;
+        mpDestroyContext(contexts[i]);
+        mpDestroyContext(refs[i]);
+    }
+    return ok;
+}
+
+// particles dropped by mpForceSetNumParticles() must stay dead when the count grows again,
+// even after updates reused their slots for other frames.
+static bool TestShrinkAndGrow(int num_particles)
+{
+    auto particles = MakeTestParticles(num_particles, 1.0f);
+    int ctx = CreateTestContext(particles, [](mpKernelParams&) {});
+    mpUpdate(ctx, g_dt);
+    mpForceSetNumParticles(ctx, num_particles / 2);
+    mpUpdate(ctx, g_dt);
+    int num_alive = mpGetNumParticles(ctx);
+    mpForceSetNumParticles(ctx, num_particles);
+    mpUpdate(ctx, g_dt);
+    int num = mpGetNumParticles(ctx);
+    mpDestroyContext(ctx);
+
+    bool ok = num == num_alive;
+    printf("shrink and grow: %s (%d particles, expected %d)\n", ok ? "OK" : "FAILED", num, num_alive);
+    return ok;
+}
+
+static bool TestPipelinedEdits(int num_particles, int num_frames)
+{
+    auto particles = MakeTestParticles(num_particles, 1.0f);
+    int ref = CreateTestContext(particles, [](mpKernelParams&) {});
+    int ctx = CreateTestContext(particles, [](mpKernelParams &kp) { kp.enable_pipelined_update = 1; });
+
+    auto edit = [&](int c, int frame) {
+        mpV3 move(0.01f, 0.0f, 0.0f);
+        mpMoveAll(c, &move);
+        for (int i = 0; i < 4; ++i) {
+            ScatterBox(c, mpV3(float(i) * 0.5f - 0.75f, 1.5f, float(frame % 8) * 0.1f), mpV3(0.0f, 0.0f, 0.0f), 1);
+        }
+
+        mpColliderProperties props;
+        memset(&props, 0, sizeof(props));
+        props.owner_id = 1;
+        props.stiffness = 1500.0f;
+        mpV3 center(0.0f, float(frame) * 0.02f - 1.5f, 0.0f);
+        mpClearCollidersAndForces(c);
+        mpAddSphereCollider(c, &props, &center, 0.5f);
+
+        if (frame == num_frames / 3) {
+            mpKernelParams kp;
+            mpGetKernelParams(c, &kp);
+            kp.damping = 0.3f;
+            mpSetKernelParams(c, &kp);
+        }
+        if (frame == num_frames / 2) {
+            mpForceSetNumParticles(c, num_particles / 2);
+        }
+    };
+    for (int i = 0; i < num_frames; ++i) {
+        mpUpdate(ref, g_dt);
+        edit(ref, i);
+
+        mpBeginUpdate(ctx, g_dt);
+        edit(ctx, i);
+        mpEndUpdate(ctx);
+    }
+    bool ok = CompareParticles("pipelined edits", ref, ctx, 1e-5f);
+    mpDestroyContext(ctx);
+    mpDestroyContext(ref);
+    return ok;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "bench_cell_ordering") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 200000;
+        BenchCellOrdering(num_particles, 100);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_kernel_variants") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 200000;
+        float particle_size = argc > 3 ? (float)atof(argv[3]) : 0.08f;
+        BenchKernelVariants(num_particles, 100, particle_size);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_fused_update") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 500000;
+        BenchFusedUpdate(num_particles, 100);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_task_graph") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 200000;
+        BenchTaskGraph(num_particles, 100);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_scheduler") == 0) {
+        int num_elements = argc > 2 ? atoi(argv[2]) : 1000000;
+        BenchScheduler(num_elements, 50);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_load_balance") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 100000;
+        BenchLoadBalance(num_particles, 100);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_update_all") == 0) {
+        int num_worlds = argc > 2 ? atoi(argv[2]) : 8;
+        int num_particles = argc > 3 ? atoi(argv[3]) : 200000;
+        BenchUpdateAll(num_worlds, num_particles, 100);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_dense_cells") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 20000;
+        BenchDenseCells(num_particles, 30);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_pipelined") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 100000;
+        BenchPipelined(num_particles, 30);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_data_layouts") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 200000;
+        BenchDataLayouts(num_particles, 100);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench_upload") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 200000;
+        double bandwidth = argc > 3 ? atof(argv[3]) : 8.0;
+        BenchUpload(num_particles, 100, bandwidth);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "test_equivalence") == 0) {
+        int num_particles = argc > 2 ? atoi(argv[2]) : 20000;
+        bool ok = TestEquivalence(num_particles, 10);
+        ok = TestUpdateAll(num_particles, 10) && ok;
+        ok = TestShrinkAndGrow(num_particles) && ok;
+        ok = TestPipelinedEdits(num_particles, 30) && ok;
+        return ok ? 0 : 1;
+    }
+
     int ctx = mpCreateContext();
     mpDestroyContext(ctx);
     return 0;